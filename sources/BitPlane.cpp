@@ -0,0 +1,335 @@
+/*
+ * This file is part of PixLabelCV.
+ *
+ * Copyright (C) 2024 Dominik Schraml
+ *
+ * PixLabelCV is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Alternatively, commercial licenses are available. Please contact SQB Ilmenau
+ * at olaf.glaessner@sqb-ilmenau.de or dominik.schraml@sqb-ilmenau.de for more details.
+ *
+ * PixLabelCV is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PixLabelCV. If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include "BitPlane.h"
+#include "Timer.h"
+#include "opencv2/core/hal/intrin.hpp"
+#include "opencv2/core/hal/hal.hpp"
+#include <atomic>
+#include <iostream>
+
+using namespace cv;
+
+typedef BitPlane::TilePtr TilePtr;
+static const int TILE_BYTES = BIT_TILE_STEP * TILE_SIZE;
+
+// 8 mask bytes (0 or 255) for every bit pattern of one byte - used to unpack the planes
+struct ExpandTable {
+	uchar bytes[256][8];
+	ExpandTable() {
+		for(int v = 0; v < 256; v++)
+			for(int j = 0; j < 8; j++)
+				bytes[v][j] = (v >> j) & 1 ? 255 : 0;
+	}
+};
+static const ExpandTable expandTable;
+
+static inline int popcountByte(uchar v) {
+	v = v - ((v >> 1) & 0x55);
+	v = (v & 0x33) + ((v >> 2) & 0x33);
+	return (v + (v >> 4)) & 0x0F;
+}
+
+
+// Applies the operation to every byte of both planes and writes it into a new plane.
+// shortcut decides the result tile without computing it when one of the tiles is empty (returns true then).
+template<typename Shortcut, typename VecOp, typename ByteOp>
+static BitPlane binaryKernel(const BitPlane& a, const BitPlane& b, Shortcut shortcut, VecOp vecOp, ByteOp byteOp) {
+	CV_Assert(a.rows == b.rows && a.cols == b.cols);
+	BitPlane dst(a.rows, a.cols);
+	parallel_for_(Range(0, a.tileCount()), [&](const Range& range) {
+		for(int t = range.start; t < range.end; t++) {
+			TilePtr result;
+			if(!shortcut(a.tile(t), b.tile(t), result)) {
+				const uchar* pa = a.tile(t)->bits;
+				const uchar* pb = b.tile(t)->bits;
+				auto tile = std::make_shared<BitTile>();
+				uchar* pd = tile->bits;
+				int x = 0;
+#if (CV_SIMD || CV_SIMD_SCALABLE)
+				const int lanes = VTraits<v_uint8>::vlanes();
+				for(; x + lanes <= TILE_BYTES; x += lanes)
+					v_store_aligned(pd + x, vecOp(vx_load_aligned(pa + x), vx_load_aligned(pb + x)));
+#endif
+				for(; x < TILE_BYTES; x++)
+					pd[x] = byteOp(pa[x], pb[x]);
+				result = tile;
+			}
+			dst.setTile(t, result);
+		}
+	});
+	return dst;
+}
+
+static int64_t popcountTile(const BitTile& tile) {
+	return cv::hal::normHamming(tile.bits, TILE_BYTES);
+}
+
+// Counts the set bits of the operation's result without storing it.
+// shortcut returns the count when one of the tiles is empty (or -1 if it has to be computed).
+template<typename Shortcut, typename VecOp, typename ByteOp>
+static int64_t countKernel(const BitPlane& a, const BitPlane& b, Shortcut shortcut, VecOp vecOp, ByteOp byteOp) {
+	CV_Assert(a.rows == b.rows && a.cols == b.cols);
+	std::atomic<int64_t> total(0);
+	parallel_for_(Range(0, a.tileCount()), [&](const Range& range) {
+		int64_t count = 0;
+		for(int t = range.start; t < range.end; t++) {
+			int64_t known = shortcut(a.tile(t), b.tile(t));
+			if(known >= 0) {
+				count += known;
+				continue;
+			}
+			const uchar* pa = a.tile(t)->bits;
+			const uchar* pb = b.tile(t)->bits;
+			int x = 0;
+#if (CV_SIMD || CV_SIMD_SCALABLE)
+			const int lanes = VTraits<v_uint8>::vlanes();
+			v_uint8 sum = vx_setzero_u8();
+			int summed = 0;
+			for(; x + lanes <= TILE_BYTES; x += lanes) {
+				sum = v_add(sum, v_popcount(vecOp(vx_load_aligned(pa + x), vx_load_aligned(pb + x))));
+				// each lane holds at most 8 per vector - reduce before the bytes could overflow
+				if(++summed == 31) {
+					count += v_reduce_sum(sum);
+					sum = vx_setzero_u8();
+					summed = 0;
+				}
+			}
+			count += v_reduce_sum(sum);
+#endif
+			for(; x < TILE_BYTES; x++)
+				count += popcountByte(byteOp(pa[x], pb[x]));
+		}
+		total += count;
+	});
+	return total;
+}
+
+
+BitPlane BitPlane::And(const BitPlane& a, const BitPlane& b) {
+	return binaryKernel(a, b, [] (const TilePtr& x, const TilePtr& y, TilePtr&) { return !x || !y; },
+						[] (const auto& x, const auto& y) { return v_and(x, y); },
+						[] (uchar x, uchar y) -> uchar { return x & y; });
+}
+
+BitPlane BitPlane::Or(const BitPlane& a, const BitPlane& b) {
+	return binaryKernel(a, b, [] (const TilePtr& x, const TilePtr& y, TilePtr& r) { r = x ? x : y; return !x || !y; },
+						[] (const auto& x, const auto& y) { return v_or(x, y); },
+						[] (uchar x, uchar y) -> uchar { return x | y; });
+}
+
+BitPlane BitPlane::Xor(const BitPlane& a, const BitPlane& b) {
+	return binaryKernel(a, b, [] (const TilePtr& x, const TilePtr& y, TilePtr& r) { r = x ? x : y; return !x || !y; },
+						[] (const auto& x, const auto& y) { return v_xor(x, y); },
+						[] (uchar x, uchar y) -> uchar { return x ^ y; });
+}
+
+BitPlane BitPlane::AndNot(const BitPlane& a, const BitPlane& b) {
+	return binaryKernel(a, b, [] (const TilePtr& x, const TilePtr& y, TilePtr& r) { r = x; return !x || !y; },
+						[] (const auto& x, const auto& y) { return v_and(x, v_not(y)); },
+						[] (uchar x, uchar y) -> uchar { return x & ~y; });
+}
+
+int64_t BitPlane::CountAnd(const BitPlane& a, const BitPlane& b) {
+	return countKernel(a, b, [] (const TilePtr& x, const TilePtr& y) -> int64_t { return !x || !y ? 0 : -1; },
+					   [] (const auto& x, const auto& y) { return v_and(x, y); },
+					   [] (uchar x, uchar y) -> uchar { return x & y; });
+}
+
+int64_t BitPlane::CountAndNot(const BitPlane& a, const BitPlane& b) {
+	return countKernel(a, b, [] (const TilePtr& x, const TilePtr& y) -> int64_t { return !x ? 0 : !y ? popcountTile(*x) : -1; },
+					   [] (const auto& x, const auto& y) { return v_and(x, v_not(y)); },
+					   [] (uchar x, uchar y) -> uchar { return x & ~y; });
+}
+
+int64_t BitPlane::CountNonZero() const {
+	int64_t count = 0;
+	for(int t = 0; t < tileCount(); t++)
+		if(tile(t)) count += popcountTile(*tile(t));
+	return count;
+}
+
+
+// dst = op(a, b) and the popcount of count(a, b) in the same pass over the tile
+template<typename VecOp, typename VecCount, typename ByteOp, typename ByteCount>
+static int64_t fusedTileKernel(const BitTile& a, const BitTile& b, BitTile& dst, VecOp vecOp, VecCount vecCount, ByteOp byteOp, ByteCount byteCount) {
+	const uchar* pa = a.bits;
+	const uchar* pb = b.bits;
+	uchar* pd = dst.bits;
+	int64_t count = 0;
+	int x = 0;
+#if (CV_SIMD || CV_SIMD_SCALABLE)
+	const int lanes = VTraits<v_uint8>::vlanes();
+	v_uint8 sum = vx_setzero_u8();
+	int summed = 0;
+	for(; x + lanes <= TILE_BYTES; x += lanes) {
+		v_uint8 va = vx_load_aligned(pa + x), vb = vx_load_aligned(pb + x);
+		v_store_aligned(pd + x, vecOp(va, vb));
+		sum = v_add(sum, v_popcount(vecCount(va, vb)));
+		if(++summed == 31) {
+			count += v_reduce_sum(sum);
+			sum = vx_setzero_u8();
+			summed = 0;
+		}
+	}
+	count += v_reduce_sum(sum);
+#endif
+	for(; x < TILE_BYTES; x++) {
+		pd[x] = byteOp(pa[x], pb[x]);
+		count += popcountByte(byteCount(pa[x], pb[x]));
+	}
+	return count;
+}
+
+int64_t BitPlane::AndNotTile(const BitTile& a, const BitTile& b, BitTile& dst) {
+	return fusedTileKernel(a, b, dst, [] (const auto& x, const auto& y) { return v_and(x, v_not(y)); },
+						   [] (const auto& x, const auto& y) { return v_and(x, y); },
+						   [] (uchar x, uchar y) -> uchar { return x & ~y; },
+						   [] (uchar x, uchar y) -> uchar { return x & y; });
+}
+
+int64_t BitPlane::OrTile(const BitTile& a, const BitTile& b, BitTile& dst) {
+	return fusedTileKernel(a, b, dst, [] (const auto& x, const auto& y) { return v_or(x, y); },
+						   [] (const auto& x, const auto& y) { return v_and(y, v_not(x)); },
+						   [] (uchar x, uchar y) -> uchar { return x | y; },
+						   [] (uchar x, uchar y) -> uchar { return y & ~x; });
+}
+
+
+BitPlane BitPlane::FromMask(const cv::Mat& mask) {
+	return FromMask(mask, Rect(0, 0, mask.cols, mask.rows));
+}
+
+BitPlane BitPlane::FromMask(const cv::Mat& mask, cv::Rect roi) {
+	CV_Assert(mask.type() == CV_8UC1);
+	BitPlane plane(mask.rows, mask.cols);
+	std::vector<int> tiles = plane.tilesIn(roi);
+	parallel_for_(Range(0, static_cast<int>(tiles.size())), [&](const Range& range) {
+		for(int k = range.start; k < range.end; k++) {
+			int t = tiles[k];
+			Rect rect = plane.tileRect(t);
+			if(countNonZero(mask(rect)) == 0) continue; // empty tiles are not allocated
+			auto tile = std::make_shared<BitTile>();
+			std::memset(tile->bits, 0, TILE_BYTES);
+			for(int y = 0; y < rect.height; y++) {
+				const uchar* src = mask.ptr<uchar>(rect.y + y) + rect.x;
+				uchar* dst = tile->bits + y * BIT_TILE_STEP;
+				int x = 0;
+				for(; x + 8 <= rect.width; x += 8) {
+					uchar bits = 0;
+					for(int j = 0; j < 8; j++)
+						bits |= (src[x + j] != 0) << j;
+					dst[x >> 3] = bits;
+				}
+				for(; x < rect.width; x++)
+					if(src[x]) dst[x >> 3] |= 1 << (x & 7);
+			}
+			plane.setTile(t, tile);
+		}
+	});
+	return plane;
+}
+
+void BitPlane::ToMask(cv::Mat& mask) const {
+	ToMask(mask, Rect(0, 0, cols, rows));
+}
+
+void BitPlane::ToMask(cv::Mat& mask, cv::Rect roi) const {
+	roi &= Rect(0, 0, cols, rows);
+	mask.create(roi.size(), CV_8U);
+	const std::vector<int> touched = tilesIn(roi);
+	parallel_for_(Range(0, static_cast<int>(touched.size())), [&](const Range& range) {
+		for(int i = range.start; i < range.end; i++) {
+			const int t = touched[i];
+			const Rect rect = tileRect(t);
+			const Rect part = rect & roi;
+			if(!tile(t)) {
+				mask(part - roi.tl()).setTo(0);
+				continue;
+			}
+			// x in the tile - whole bytes are expanded with the table
+			const int x0 = part.x - rect.x, x1 = x0 + part.width;
+			for(int y = part.y - rect.y; y < part.y - rect.y + part.height; y++) {
+				const uchar* src = tile(t)->bits + y * BIT_TILE_STEP;
+				uchar* dst = mask.ptr<uchar>(rect.y + y - roi.y) + rect.x - roi.x;
+				int x = x0;
+				for(; x < x1 && (x & 7); x++)
+					dst[x] = (src[x >> 3] >> (x & 7)) & 1 ? 255 : 0;
+				for(; x + 8 <= x1; x += 8)
+					std::memcpy(dst + x, expandTable.bytes[src[x >> 3]], 8);
+				for(; x < x1; x++)
+					dst[x] = (src[x >> 3] >> (x & 7)) & 1 ? 255 : 0;
+			}
+		}
+	});
+}
+
+cv::UMat BitPlane::ToUMat() const {
+	cv::Mat mask;
+	ToMask(mask);
+	cv::UMat region;
+	mask.copyTo(region);
+	return region;
+}
+
+
+void BenchmarkBitPlanes(int rows, int cols, int iterations) {
+	if(rows <= 0 || cols <= 0) return;
+	cv::Mat a(rows, cols, CV_8U), b(rows, cols, CV_8U);
+	randu(a, 0, 2);
+	randu(b, 0, 2);
+	a *= 255;
+	b *= 255;
+
+	// the operations of LabelState::addRegionToClass for one class
+	UMat classMask = a.getUMat(ACCESS_READ), region = b.getUMat(ACCESS_READ);
+	{
+		std::cout << "UMat and, count, xor, or, norm (" << iterations << "x " << cols << "x" << rows << "): ";
+		Timer timer;
+		for(int i = 0; i < iterations; i++) {
+			UMat intersection, regionToKeep, result;
+			cv::bitwise_and(classMask, region, intersection);
+			cv::countNonZero(intersection);
+			cv::bitwise_xor(classMask, intersection, regionToKeep);
+			cv::bitwise_or(regionToKeep, region, result);
+			cv::norm(regionToKeep, result, cv::NORM_INF);
+		}
+	}
+
+	BitPlane classPlane = BitPlane::FromMask(a), regionPlane = BitPlane::FromMask(b);
+	{
+		std::cout << "BitPlane count, and not, or, count: ";
+		Timer timer;
+		for(int i = 0; i < iterations; i++) {
+			BitPlane::CountAnd(classPlane, regionPlane);
+			BitPlane regionToKeep = BitPlane::AndNot(classPlane, regionPlane);
+			BitPlane result = BitPlane::Or(regionToKeep, regionPlane);
+			BitPlane::CountAndNot(regionPlane, regionToKeep);
+		}
+	}
+	{
+		std::cout << "BitPlane conversion from and to 8 bit mask: ";
+		Timer timer;
+		cv::Mat mask;
+		BitPlane::FromMask(a).ToMask(mask);
+	}
+}
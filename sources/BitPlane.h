@@ -0,0 +1,69 @@
+/*
+ * This file is part of PixLabelCV.
+ *
+ * Copyright (C) 2024 Dominik Schraml
+ *
+ * PixLabelCV is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Alternatively, commercial licenses are available. Please contact SQB Ilmenau
+ * at olaf.glaessner@sqb-ilmenau.de or dominik.schraml@sqb-ilmenau.de for more details.
+ *
+ * PixLabelCV is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PixLabelCV. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include "opencv2/core.hpp"
+#include "TileGrid.h"
+
+// Bytes per tile row. Not padded to 64: the tile is 64 byte aligned, so every row starts 32 byte aligned
+// (a whole AVX2 register) and two rows share a cache line - padding would double the planes for nothing.
+const int BIT_TILE_STEP = TILE_SIZE / 8;
+
+// TILE_SIZE x TILE_SIZE pixels with one bit per pixel (bit x%8 of byte x/8 is pixel x of the row).
+// Pixels outside of the image (border tiles) stay zero, so the kernels always process whole tiles.
+struct alignas(64) BitTile {
+	uchar bits[BIT_TILE_STEP * TILE_SIZE];
+};
+
+// Binary class mask with one bit per pixel, stored in copy-on-write tiles.
+// All operations write into a new plane that shares every tile it can with the inputs (e.g. Or with an empty 
+// tile just takes the other tile), so a plane is never changed once it is in a state.
+class BitPlane : public TileGrid<BitTile>
+{
+public:
+	BitPlane() {}
+	BitPlane(int rows, int cols) : TileGrid(rows, cols) {} // all pixels zero - no tile allocated
+
+	// conversion at the I/O and display boundaries (0 / != 0  <-> 0 / 255)
+	static BitPlane FromMask(const cv::Mat& mask);
+	static BitPlane FromMask(const cv::Mat& mask, cv::Rect roi); // mask is zero outside of roi
+	void ToMask(cv::Mat& mask) const;
+	void ToMask(cv::Mat& mask, cv::Rect roi) const; // mask has the size of roi
+	cv::UMat ToUMat() const;
+
+	// mask algebra
+	static BitPlane And(const BitPlane& a, const BitPlane& b);
+	static BitPlane Or(const BitPlane& a, const BitPlane& b);
+	static BitPlane Xor(const BitPlane& a, const BitPlane& b);
+	static BitPlane AndNot(const BitPlane& a, const BitPlane& b); // a without b
+	// popcount of the pixels without creating the resulting plane
+	static int64_t CountAnd(const BitPlane& a, const BitPlane& b);
+	static int64_t CountAndNot(const BitPlane& a, const BitPlane& b);
+	int64_t CountNonZero() const;
+
+	// fused tile kernels - the result and the number of changed pixels in one pass
+	static int64_t AndNotTile(const BitTile& a, const BitTile& b, BitTile& dst); // dst = a without b, returns removed pixels
+	static int64_t OrTile(const BitTile& a, const BitTile& b, BitTile& dst);     // dst = a or b, returns added pixels
+};
+
+// compare the bit planes with the byte masks (UMat) - prints the timings to the console
+void BenchmarkBitPlanes(int rows, int cols, int iterations = 10);
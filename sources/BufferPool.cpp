@@ -0,0 +1,84 @@
+/*
+ * This file is part of PixLabelCV.
+ *
+ * Copyright (C) 2024 Dominik Schraml
+ *
+ * PixLabelCV is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Alternatively, commercial licenses are available. Please contact SQB Ilmenau
+ * at olaf.glaessner@sqb-ilmenau.de or dominik.schraml@sqb-ilmenau.de for more details.
+ *
+ * PixLabelCV is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PixLabelCV. If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include "BufferPool.h"
+#include <chrono>
+
+template<typename Buffer>
+Buffer BufferPool::get(std::map<Key, Buffer>& buffers, const std::string& slot, cv::Size size, int type) {
+	std::lock_guard<std::mutex> lock(mutex);
+	const Key key(slot, size.height, size.width, type);
+	auto found = buffers.find(key);
+	if(enabled && found != buffers.end()) {
+		counters.reuses++;
+		return found->second;
+	}
+
+	auto start = std::chrono::high_resolution_clock::now();
+	Buffer buffer(size, type);
+	counters.allocationMs += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	counters.allocations++;
+	if(enabled) {
+		buffers[key] = buffer;
+		trackedBytes.Add(int64_t(size.area()) * CV_ELEM_SIZE(type));
+	}
+	return buffer;
+}
+
+cv::UMat BufferPool::GetUMat(const std::string& slot, cv::Size size, int type) {
+	return get(umats, slot, size, type);
+}
+
+cv::Mat BufferPool::GetMat(const std::string& slot, cv::Size size, int type) {
+	return get(mats, slot, size, type);
+}
+
+int64_t BufferPool::evict() {
+	std::lock_guard<std::mutex> lock(mutex);
+	// buffers still in use stay alive through their other headers - they are only no longer reused
+	const int64_t bytes = trackedBytes.Bytes();
+	umats.clear();
+	mats.clear();
+	trackedBytes.Set(0);
+	return bytes;
+}
+
+int64_t BufferPool::MissingBytes(const std::string& slot, cv::Size size, int type) {
+	std::lock_guard<std::mutex> lock(mutex);
+	if(enabled && umats.count(Key(slot, size.height, size.width, type)) > 0) return 0;
+	return int64_t(size.area()) * CV_ELEM_SIZE(type);
+}
+
+void BufferPool::Clear() {
+	evict();
+}
+
+void BufferPool::SetEnabled(bool enable) {
+	if(!enable) Clear();
+	std::lock_guard<std::mutex> lock(mutex);
+	enabled = enable;
+}
+
+BufferPool::Counters BufferPool::Totals() {
+	std::lock_guard<std::mutex> lock(mutex);
+	return counters;
+}
@@ -0,0 +1,77 @@
+/*
+ * This file is part of PixLabelCV.
+ *
+ * Copyright (C) 2024 Dominik Schraml
+ *
+ * PixLabelCV is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Alternatively, commercial licenses are available. Please contact SQB Ilmenau
+ * at olaf.glaessner@sqb-ilmenau.de or dominik.schraml@sqb-ilmenau.de for more details.
+ *
+ * PixLabelCV is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PixLabelCV. If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include "opencv2/core.hpp"
+#include "MemoryTracker.h"
+#include <map>
+#include <mutex>
+#include <string>
+#include <tuple>
+
+// Full size temporaries of the CV operations (display copy, RGBA result, temporary masks, markers, ...) kept 
+// between the evaluations. A buffer is identified by its slot name, size and type and only allocated the first 
+// time - so repeating an operation on the same image allocates nothing. Cleared when a new image is loaded 
+// and counted as cache by the memory tracker (evicted first when the memory budget is exceeded).
+class BufferPool
+{
+public:
+	static BufferPool& Instance() {
+		static BufferPool instance;
+		return instance;
+	}
+
+	// the buffer's content is undefined (whatever the last user left) - the header shares the pooled data
+	cv::UMat GetUMat(const std::string& slot, cv::Size size, int type);
+	cv::Mat GetMat(const std::string& slot, cv::Size size, int type);
+	void Clear();
+	// bytes GetUMat would have to allocate for the buffer (0 if it is pooled) - to reserve only those
+	int64_t MissingBytes(const std::string& slot, cv::Size size, int type);
+
+	// disabled: every request allocates a new buffer (to compare against the former behaviour)
+	void SetEnabled(bool enable);
+	bool Enabled() const { return enabled; }
+
+	struct Counters {
+		int allocations = 0;      // buffers allocated
+		double allocationMs = 0;  // time spent allocating them
+		int reuses = 0;           // requests served from the pool
+	};
+	Counters Totals();
+
+private:
+	BufferPool() {
+		MemoryTracker::Instance().AddEvictor(MemoryOwner::Cache, [this](int64_t) { return evict(); });
+	}
+	BufferPool(BufferPool const&);        // Don't Implement.
+	void operator = (BufferPool const&);  // Don't implement 
+
+	typedef std::tuple<std::string, int, int, int> Key; // slot, rows, cols, type
+	template<typename Buffer> Buffer get(std::map<Key, Buffer>& buffers, const std::string& slot, cv::Size size, int type);
+	int64_t evict();
+
+	std::map<Key, cv::UMat> umats;
+	std::map<Key, cv::Mat> mats;
+	bool enabled = true;
+	Counters counters;
+	std::mutex mutex;
+	TrackedBytes trackedBytes{ MemoryOwner::Cache };
+};
@@ -0,0 +1,148 @@
+/*
+ * This file is part of PixLabelCV.
+ *
+ * Copyright (C) 2024 Dominik Schraml
+ *
+ * PixLabelCV is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Alternatively, commercial licenses are available. Please contact SQB Ilmenau
+ * at olaf.glaessner@sqb-ilmenau.de or dominik.schraml@sqb-ilmenau.de for more details.
+ *
+ * PixLabelCV is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PixLabelCV. If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include "ClassOverlay.h"
+#include <filesystem>
+#include "ImageProcessing.h" // class colors
+
+using namespace cv;
+
+// palette as RGBA - background and unlabeled pixels are the same in the label map, so class 0 is transparent there
+static void updatePalette(std::vector<Vec4b>& palette, const std::vector<uchar>& hidden, const MaskState& state) {
+	const size_t size = std::max<size_t>(state.numClasses, state.stats.classes.size());
+	palette.resize(std::max(palette.size(), size));
+	for(size_t i = 0; i < palette.size(); i++) {
+		Vec3b col = ClassColor(static_cast<int>(i));
+		palette[i] = Vec4b(col[0], col[1], col[2], 255);
+		if(i < hidden.size() && hidden[i]) palette[i] = Vec4b(0, 0, 0, 0);
+	}
+	if(!palette.empty() && !state.labelMap.empty()) palette[0] = Vec4b(0, 0, 0, 0);
+}
+
+// writes the colors of all pixels of the tile into the overlay
+static void colorizeTile(const MaskState& state, const std::vector<Vec4b>& palette, int t, Rect rect, Mat& overlay) {
+	overlay(rect).setTo(Scalar::all(0));
+	if(!state.labelMap.empty()) {
+		if(!state.labelMap.tile(t)) return;
+		const Mat& labels = *state.labelMap.tile(t);
+		for(int y = 0; y < rect.height; y++) {
+			const ushort* l = labels.ptr<ushort>(y);
+			Vec4b* dst = overlay.ptr<Vec4b>(rect.y + y) + rect.x;
+			for(int x = 0; x < rect.width; x++)
+				if(l[x] < palette.size()) dst[x] = palette[l[x]];
+		}
+	} else {
+		// overlapping classes mix their colors (or)
+		for(int c = 0; c < state.classPlanes.size() && c < palette.size(); c++) {
+			if(state.classPlanes[c].empty() || !state.classPlanes[c].tile(t) || palette[c][3] == 0) continue;
+			const uint32_t color = *reinterpret_cast<const uint32_t*>(&palette[c]);
+			const uchar* bits = state.classPlanes[c].tile(t)->bits;
+			for(int y = 0; y < rect.height; y++) {
+				const uchar* src = bits + y * BIT_TILE_STEP;
+				uint32_t* dst = overlay.ptr<uint32_t>(rect.y + y) + rect.x;
+				for(int x = 0; x < rect.width; x++)
+					if((src[x >> 3] >> (x & 7)) & 1) dst[x] |= color;
+			}
+		}
+	}
+}
+
+
+void ClassOverlay::SetClassVisible(int classNr, bool visible) {
+	if(classNr < 0 || ClassVisible(classNr) == visible) return;
+	if(hidden.size() <= classNr) hidden.resize(classNr + 1, 0);
+	hidden[classNr] = !visible;
+	visibilityChanged.push_back(classNr);
+}
+
+const cv::Mat& ClassOverlay::Update(const MaskState& state) {
+	const TileGrid<BitTile> grid(state.size.height, state.size.width);
+	std::vector<uchar> changed(grid.tileCount(), 0);
+	if(!valid || overlay.size() != state.size || shown.labelMap.empty() != state.labelMap.empty()) {
+		overlay.create(state.size, CV_8UC4);
+		trackedBytes.Set(int64_t(overlay.total()) * overlay.elemSize());
+		std::fill(changed.begin(), changed.end(), 1);
+		valid = true;
+	} else {
+		// tiles not shared with the shown state - colors of existing classes never change, so a larger palette needs no update
+		if(!state.labelMap.empty())
+			state.labelMap.markChangedTiles(shown.labelMap, changed);
+		static const BitPlane noPlane;
+		for(size_t c = 0; c < std::max(state.classPlanes.size(), shown.classPlanes.size()); c++) {
+			const BitPlane& now = c < state.classPlanes.size() ? state.classPlanes[c] : noPlane;
+			const BitPlane& before = c < shown.classPlanes.size() ? shown.classPlanes[c] : noPlane;
+			if(!now.empty()) now.markChangedTiles(before, changed);
+			else if(!before.empty()) before.markChangedTiles(now, changed);
+		}
+		// the tiles that contain a class that was shown or hidden
+		for(int c : visibilityChanged)
+			for(int t = 0; t < state.stats.tiles.size() && t < changed.size(); t++) {
+				const auto& tileStats = state.stats.tiles[t];
+				if(tileStats && c < tileStats->size() && (*tileStats)[c].pixels > 0) changed[t] = 1;
+			}
+	}
+	visibilityChanged.clear();
+	updatePalette(palette, hidden, state);
+
+	updatedTiles.clear();
+	for(int t = 0; t < changed.size(); t++)
+		if(changed[t]) updatedTiles.push_back(t);
+	if(!state.empty()) {
+		parallel_for_(Range(0, static_cast<int>(updatedTiles.size())), [&](const Range& range) {
+			for(int i = range.start; i < range.end; i++)
+				colorizeTile(state, palette, updatedTiles[i], grid.tileRect(updatedTiles[i]), overlay);
+		});
+	} else
+		overlay.setTo(Scalar::all(0));
+	shown = state;
+	return overlay;
+}
+
+std::vector<cv::Rect> ClassOverlay::UpdatedRects() const {
+	const TileGrid<BitTile> grid(overlay.rows, overlay.cols);
+	std::vector<cv::Rect> rects;
+	rects.reserve(updatedTiles.size());
+	for(int t : updatedTiles)
+		rects.push_back(grid.tileRect(t));
+	return rects;
+}
+
+
+void CompositeLayers(const cv::Mat& base, const cv::Mat& overlay, float alpha, cv::Mat& out) {
+	CV_Assert(base.type() == CV_8UC3 && overlay.type() == CV_8UC4 && base.size() == overlay.size());
+	out.create(base.size(), CV_8UC4);
+	const int scale = cvRound(std::clamp(alpha, 0.0f, 1.0f) * 256);
+	parallel_for_(Range(0, base.rows), [&](const Range& range) {
+		for(int y = range.start; y < range.end; y++) {
+			const Vec3b* b = base.ptr<Vec3b>(y);
+			const Vec4b* o = overlay.ptr<Vec4b>(y);
+			Vec4b* dst = out.ptr<Vec4b>(y);
+			for(int x = 0; x < base.cols; x++) {
+				// a in 0..256
+				const int a = (o[x][3] * scale + 127) / 255;
+				dst[x] = Vec4b(static_cast<uchar>((b[x][2] * (256 - a) + o[x][0] * a) >> 8),
+							   static_cast<uchar>((b[x][1] * (256 - a) + o[x][1] * a) >> 8),
+							   static_cast<uchar>((b[x][0] * (256 - a) + o[x][2] * a) >> 8), 255);
+			}
+		}
+	}, base.rows / 16 + 1);
+}
@@ -0,0 +1,60 @@
+/*
+ * This file is part of PixLabelCV.
+ *
+ * Copyright (C) 2024 Dominik Schraml
+ *
+ * PixLabelCV is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Alternatively, commercial licenses are available. Please contact SQB Ilmenau
+ * at olaf.glaessner@sqb-ilmenau.de or dominik.schraml@sqb-ilmenau.de for more details.
+ *
+ * PixLabelCV is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PixLabelCV. If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include "MaskState.h"
+#include "MemoryTracker.h"
+
+// The label overlay layer: the class color of every pixel as RGBA - alpha 255 where a (visible) class is labeled,
+// 0 elsewhere. It is drawn over the image at draw time, so the blend factor and showing or hiding the layer cost
+// nothing here. Update() recolors only the tiles whose label map or class plane tiles changed since the last 
+// update (and the tiles of classes whose visibility changed) - independent of the number of classes.
+class ClassOverlay
+{
+public:
+	static ClassOverlay& Instance() { // the layer of the main display
+		static ClassOverlay instance;
+		return instance;
+	}
+
+	const cv::Mat& Update(const MaskState& state);
+	void Invalidate() { valid = false; } // the next update recolors everything
+	const std::vector<int>& UpdatedTiles() const { return updatedTiles; } // by the last update
+	std::vector<cv::Rect> UpdatedRects() const; // of the updated tiles
+
+	// hidden classes are transparent - only the tiles that contain the class are recolored
+	void SetClassVisible(int classNr, bool visible);
+	bool ClassVisible(int classNr) const { return classNr >= hidden.size() || !hidden[classNr]; }
+
+private:
+	cv::Mat overlay;
+	MaskState shown; // the state the overlay shows (shares its tiles)
+	std::vector<cv::Vec4b> palette;
+	std::vector<uchar> hidden;
+	std::vector<int> visibilityChanged; // classes to recolor with the next update
+	bool valid = false;
+	std::vector<int> updatedTiles;
+	TrackedBytes trackedBytes{ MemoryOwner::Display };
+};
+
+// CPU reference of the draw time blending (like the GPU: the overlay's alpha scaled by alpha, source over):
+// out = base * (1 - alpha * a) + overlay * alpha * a. base is the BGR image, out and overlay are RGBA.
+void CompositeLayers(const cv::Mat& base, const cv::Mat& overlay, float alpha, cv::Mat& out);
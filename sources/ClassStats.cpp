@@ -0,0 +1,177 @@
+/*
+ * This file is part of PixLabelCV.
+ *
+ * Copyright (C) 2024 Dominik Schraml
+ *
+ * PixLabelCV is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Alternatively, commercial licenses are available. Please contact SQB Ilmenau
+ * at olaf.glaessner@sqb-ilmenau.de or dominik.schraml@sqb-ilmenau.de for more details.
+ *
+ * PixLabelCV is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PixLabelCV. If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include "ClassStats.h"
+#include "MaskState.h"
+#include <climits>
+
+using namespace cv;
+
+static void include(ClassStats& stats, int64_t pixels, Rect bbox) {
+	if(pixels == 0) return;
+	stats.pixels += pixels;
+	stats.bbox |= bbox;
+}
+
+// one pass over the label tile for all classes - unallocated tiles are only background
+static void labelTileStats(const LabelMap& map, int t, std::vector<ClassStats>& stats) {
+	Rect rect = map.tileRect(t);
+	if(!map.tile(t)) {
+		stats.resize(1);
+		include(stats[0], rect.area(), rect);
+		return;
+	}
+	const Mat& labels = *map.tile(t);
+	// only as many bins as the highest label of this tile - independent of the number of classes
+	double maxLabel = 0;
+	minMaxIdx(labels, nullptr, &maxLabel);
+	const int bins = static_cast<int>(maxLabel) + 1;
+	std::vector<int> counts(bins, 0), minX(bins, INT_MAX), maxX(bins, -1), minY(bins, INT_MAX), maxY(bins, -1);
+	for(int y = 0; y < labels.rows; y++) {
+		const ushort* row = labels.ptr<ushort>(y);
+		for(int x = 0; x < labels.cols; x++) {
+			const ushort l = row[x];
+			counts[l]++;
+			minX[l] = std::min(minX[l], x);
+			maxX[l] = std::max(maxX[l], x);
+			minY[l] = std::min(minY[l], y);
+			maxY[l] = y;
+		}
+	}
+	if(stats.size() < bins) stats.resize(bins);
+	for(int l = 0; l < bins; l++) {
+		if(counts[l] == 0) continue;
+		include(stats[l], counts[l], Rect(rect.x + minX[l], rect.y + minY[l], maxX[l] - minX[l] + 1, maxY[l] - minY[l] + 1));
+	}
+}
+
+static void bitTileStats(const BitPlane& plane, int t, ClassStats& stats) {
+	if(plane.empty() || !plane.tile(t)) return;
+	Rect rect = plane.tileRect(t);
+	int64_t pixels = 0;
+	int minX = INT_MAX, maxX = -1, minY = INT_MAX, maxY = -1;
+	for(int y = 0; y < rect.height; y++) {
+		const uchar* row = plane.tile(t)->bits + y * BIT_TILE_STEP;
+		int first = -1, last = -1;
+		for(int b = 0; b < BIT_TILE_STEP; b++) {
+			if(row[b] == 0) continue;
+			for(int j = 0; j < 8; j++) {
+				if(!((row[b] >> j) & 1)) continue;
+				pixels++;
+				if(first < 0) first = b * 8 + j;
+				last = b * 8 + j;
+			}
+		}
+		if(first < 0) continue;
+		minX = std::min(minX, first);
+		maxX = std::max(maxX, last);
+		minY = std::min(minY, y);
+		maxY = y;
+	}
+	if(pixels > 0)
+		include(stats, pixels, Rect(rect.x + minX, rect.y + minY, maxX - minX + 1, maxY - minY + 1));
+}
+
+
+// the class box is only shrunk if the tile's former pixels were at one of its edges
+static bool touchesEdge(Rect tileBox, Rect classBox) {
+	return !tileBox.empty() && (tileBox.x == classBox.x || tileBox.y == classBox.y
+								|| tileBox.br().x == classBox.br().x || tileBox.br().y == classBox.br().y);
+}
+
+void UpdateClassStats(MaskState& state) {
+	const bool labelMode = !state.labelMap.empty();
+	const int tileCount = TileGrid<BitTile>(state.size.height, state.size.width).tileCount();
+
+	std::vector<int> dirty = state.dirtyTiles;
+	const bool rebuild = state.stats.tiles.size() != tileCount;
+	if(rebuild) {
+		// new size (image) - everything has to be computed
+		state.stats.tiles.assign(tileCount, nullptr);
+		dirty.clear();
+		for(int t = 0; t < tileCount; t++)
+			dirty.push_back(t);
+	}
+	// the entries the class sums contain now
+	std::vector<std::shared_ptr<const std::vector<ClassStats>>> before(dirty.size());
+	for(size_t k = 0; k < dirty.size(); k++)
+		before[k] = state.stats.tiles[dirty[k]];
+
+	parallel_for_(Range(0, static_cast<int>(dirty.size())), [&](const Range& range) {
+		for(int k = range.start; k < range.end; k++) {
+			const int t = dirty[k];
+			auto tileStats = std::make_shared<std::vector<ClassStats>>();
+			if(labelMode)
+				labelTileStats(state.labelMap, t, *tileStats);
+			else {
+				tileStats->resize(state.classPlanes.size());
+				for(size_t i = 0; i < state.classPlanes.size(); i++)
+					bitTileStats(state.classPlanes[i], t, (*tileStats)[i]); // skips empty planes
+			}
+			state.stats.tiles[t] = tileStats;
+		}
+	});
+
+	std::vector<ClassStats>& classes = state.stats.classes;
+	if(rebuild) {
+		// sum up the tiles - cheap compared to scanning the pixels
+		classes.assign(std::max<size_t>(state.numClasses, 1), ClassStats());
+		for(const auto& tileStats : state.stats.tiles) {
+			if(!tileStats) continue;
+			if(classes.size() < tileStats->size()) classes.resize(tileStats->size());
+			for(size_t i = 0; i < tileStats->size(); i++)
+				include(classes[i], (*tileStats)[i].pixels, (*tileStats)[i].bbox);
+		}
+		return;
+	}
+
+	// only the dirty tiles: their former entries out, the new ones in
+	if(classes.size() < state.numClasses) classes.resize(state.numClasses);
+	std::vector<uchar> shrunk(classes.size(), 0);
+	const ClassStats none;
+	for(size_t k = 0; k < dirty.size(); k++) {
+		const std::vector<ClassStats>* old = before[k].get();
+		const std::vector<ClassStats>& now = *state.stats.tiles[dirty[k]];
+		const size_t n = std::max(old ? old->size() : 0, now.size());
+		if(classes.size() < n) {
+			classes.resize(n);
+			shrunk.resize(n, 0);
+		}
+		for(size_t i = 0; i < n; i++) {
+			const ClassStats& o = old && i < old->size() ? (*old)[i] : none;
+			const ClassStats& c = i < now.size() ? now[i] : none;
+			if(o.pixels == c.pixels && o.bbox == c.bbox) continue;
+			classes[i].pixels += c.pixels - o.pixels;
+			if(touchesEdge(o.bbox, classes[i].bbox)) shrunk[i] = 1;
+			if(c.pixels > 0) classes[i].bbox |= c.bbox;
+		}
+	}
+	// the boxes that may have become smaller - from the tile entries of that class only
+	for(size_t i = 0; i < classes.size(); i++) {
+		if(!shrunk[i]) continue;
+		classes[i].bbox = Rect();
+		if(classes[i].pixels == 0) continue;
+		for(const auto& tileStats : state.stats.tiles)
+			if(tileStats && i < tileStats->size() && (*tileStats)[i].pixels > 0)
+				classes[i].bbox |= (*tileStats)[i].bbox;
+	}
+}
@@ -0,0 +1,44 @@
+/*
+ * This file is part of PixLabelCV.
+ *
+ * Copyright (C) 2024 Dominik Schraml
+ *
+ * PixLabelCV is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Alternatively, commercial licenses are available. Please contact SQB Ilmenau
+ * at olaf.glaessner@sqb-ilmenau.de or dominik.schraml@sqb-ilmenau.de for more details.
+ *
+ * PixLabelCV is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PixLabelCV. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include "opencv2/core.hpp"
+#include <memory>
+#include <vector>
+
+struct MaskState;
+
+struct ClassStats {
+	int64_t pixels = 0;
+	cv::Rect bbox; // tight bounding box of the pixels - empty if the class has none
+};
+
+// Statistics of all classes, kept per tile so an edit only recomputes the tiles it changed.
+// The tile entries are shared between the states like the tiles themselves.
+struct MaskStats {
+	std::vector<std::shared_ptr<const std::vector<ClassStats>>> tiles; // [tile][class]
+	std::vector<ClassStats> classes;                                     // sum of all tiles
+};
+
+// recomputes the statistics of the state's dirty tiles (all tiles if the size changed) and applies their difference
+// to the class sums - a bounding box is only rebuilt from the tile entries when it may have shrunk
+void UpdateClassStats(MaskState& state);
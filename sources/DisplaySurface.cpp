@@ -0,0 +1,187 @@
+/*
+ * This file is part of PixLabelCV.
+ *
+ * Copyright (C) 2024 Dominik Schraml
+ *
+ * PixLabelCV is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Alternatively, commercial licenses are available. Please contact SQB Ilmenau
+ * at olaf.glaessner@sqb-ilmenau.de or dominik.schraml@sqb-ilmenau.de for more details.
+ *
+ * PixLabelCV is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PixLabelCV. If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include "DisplaySurface.h"
+#include <cstring>
+#include <iostream>
+#include <atomic>
+#include "timer.h"
+
+using namespace cv;
+
+bool MemoryTileUploader::Upload(int tile, const cv::Mat& rgba) {
+	if(tiles.size() <= tile) tiles.resize(tile + 1);
+	rgba.copyTo(tiles[tile]);
+	uploads++;
+	bytes += int64_t(rgba.total()) * rgba.elemSize();
+	return true;
+}
+
+
+void DisplaySurface::reset(cv::Size size) {
+	frame.create(size, CV_8UC4);
+	trackedBytes.Set(int64_t(frame.total()) * frame.elemSize());
+	tilesX = (size.width + DISPLAY_TILE_SIZE - 1) / DISPLAY_TILE_SIZE;
+	const int tilesY = (size.height + DISPLAY_TILE_SIZE - 1) / DISPLAY_TILE_SIZE;
+	dirty.assign(static_cast<size_t>(tilesX) * tilesY, 1);
+}
+
+cv::Rect DisplaySurface::TileRect(int tile) const {
+	const int x = (tile % tilesX) * DISPLAY_TILE_SIZE, y = (tile / tilesX) * DISPLAY_TILE_SIZE;
+	return Rect(x, y, std::min(DISPLAY_TILE_SIZE, frame.cols - x), std::min(DISPLAY_TILE_SIZE, frame.rows - y));
+}
+
+std::vector<int> DisplaySurface::TilesIn(cv::Rect rect) const {
+	std::vector<int> tiles;
+	rect &= Rect(0, 0, frame.cols, frame.rows);
+	if(rect.empty()) return tiles;
+	for(int ty = rect.y / DISPLAY_TILE_SIZE; ty <= (rect.y + rect.height - 1) / DISPLAY_TILE_SIZE; ty++)
+		for(int tx = rect.x / DISPLAY_TILE_SIZE; tx <= (rect.x + rect.width - 1) / DISPLAY_TILE_SIZE; tx++)
+			tiles.push_back(ty * tilesX + tx);
+	return tiles;
+}
+
+// compares the tile row by row with the kept frame and copies it if anything differs
+bool DisplaySurface::updateTile(int tile, const cv::Mat& rgba) {
+	const Rect rect = TileRect(tile);
+	const size_t rowBytes = size_t(rect.width) * 4;
+	int y = 0;
+	while(y < rect.height && std::memcmp(frame.ptr(rect.y + y, rect.x), rgba.ptr(rect.y + y, rect.x), rowBytes) == 0)
+		y++;
+	if(y == rect.height) return false;
+	rgba(rect).copyTo(frame(rect));
+	const bool changed = !dirty[tile];
+	dirty[tile] = 1;
+	return changed;
+}
+
+void DisplaySurface::SetFrame(const cv::Mat& rgba) {
+	CV_Assert(rgba.type() == CV_8UC4);
+	counters.frames++;
+	if(rgba.size() != frame.size()) {
+		reset(rgba.size());
+		rgba.copyTo(frame);
+		counters.changedTiles += TileCount();
+		return;
+	}
+	std::atomic<int> changed{ 0 };
+	parallel_for_(Range(0, TileCount()), [&](const Range& range) {
+		for(int t = range.start; t < range.end; t++)
+			if(updateTile(t, rgba)) changed++;
+	});
+	counters.changedTiles += changed;
+}
+
+void DisplaySurface::SetFrame(const cv::Mat& rgba, const std::vector<cv::Rect>& changed) {
+	CV_Assert(rgba.type() == CV_8UC4);
+	if(rgba.size() != frame.size()) {
+		SetFrame(rgba);
+		return;
+	}
+	counters.frames++;
+	for(const Rect& rect : changed) {
+		const Rect clipped = rect & Rect(0, 0, frame.cols, frame.rows);
+		if(clipped.empty()) continue;
+		rgba(clipped).copyTo(frame(clipped));
+		MarkDirty(clipped);
+	}
+}
+
+cv::Mat& DisplaySurface::Frame(cv::Size size) {
+	if(size != frame.size()) {
+		reset(size);
+		counters.changedTiles += TileCount();
+	}
+	return frame;
+}
+
+void DisplaySurface::MarkDirty(cv::Rect rect) {
+	for(int t : TilesIn(rect)) {
+		if(!dirty[t]) counters.changedTiles++;
+		dirty[t] = 1;
+	}
+}
+
+void DisplaySurface::MarkAllDirty() {
+	std::fill(dirty.begin(), dirty.end(), 1);
+}
+
+int DisplaySurface::Upload(cv::Rect visible, TileUploader& uploader) {
+	int uploaded = 0;
+	for(int t : TilesIn(visible)) {
+		if(!dirty[t]) continue;
+		const Rect rect = TileRect(t);
+		if(!uploader.Upload(t, frame(rect))) continue; // stays dirty - tried again with the next frame
+		dirty[t] = 0;
+		uploaded++;
+		counters.uploadedBytes += int64_t(rect.area()) * 4;
+	}
+	counters.uploadedTiles += uploaded;
+	return uploaded;
+}
+
+
+void BenchmarkDisplaySurface(int rows, int cols) {
+	if(rows <= 0 || cols <= 0) return;
+	Mat frame(rows, cols, CV_8UC4);
+	randu(frame, 0, 256);
+	DisplaySurface surface;
+	MemoryTileUploader uploader;
+	surface.SetFrame(frame);
+	surface.Upload(Rect(0, 0, cols, rows), uploader);
+
+	{
+		std::cout << "full frame copy (former upload): ";
+		Timer timer;
+		Mat target(rows, cols, CV_8UC4);
+		for(int y = 0; y < rows; y++)
+			std::memcpy(target.ptr(y), frame.ptr(y), size_t(cols) * 4);
+	}
+	{
+		// 200 x 200 pixel ROI changed
+		frame(Rect(cols / 2, rows / 2, std::min(200, cols / 2), std::min(200, rows / 2))).setTo(Scalar(1, 2, 3, 255));
+		std::cout << "small ROI: dirty detection + upload of ";
+		const int before = uploader.uploads;
+		Timer timer;
+		surface.SetFrame(frame);
+		surface.Upload(Rect(0, 0, cols, rows), uploader);
+		std::cout << uploader.uploads - before << " tiles: ";
+	}
+	{
+		frame.setTo(Scalar(4, 5, 6, 255));
+		std::cout << "full frame: dirty detection + upload of ";
+		const int before = uploader.uploads;
+		Timer timer;
+		surface.SetFrame(frame);
+		surface.Upload(Rect(0, 0, cols, rows), uploader);
+		std::cout << uploader.uploads - before << " tiles: ";
+	}
+	{
+		frame.setTo(Scalar(7, 8, 9, 255));
+		std::cout << "full frame, quarter visible: ";
+		const int before = uploader.uploads;
+		Timer timer;
+		surface.SetFrame(frame);
+		surface.Upload(Rect(0, 0, cols / 2, rows / 2), uploader);
+		std::cout << uploader.uploads - before << " tiles: ";
+	}
+}
@@ -0,0 +1,106 @@
+/*
+ * This file is part of PixLabelCV.
+ *
+ * Copyright (C) 2024 Dominik Schraml
+ *
+ * PixLabelCV is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Alternatively, commercial licenses are available. Please contact SQB Ilmenau
+ * at olaf.glaessner@sqb-ilmenau.de or dominik.schraml@sqb-ilmenau.de for more details.
+ *
+ * PixLabelCV is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PixLabelCV. If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include "opencv2/core.hpp"
+#include "MemoryTracker.h"
+#include <vector>
+
+// width and height of one display tile - well below the texture limit of the GPUs (16384 px)
+const int DISPLAY_TILE_SIZE = 1024;
+
+// Receives the pixels of the display tiles: one texture per tile on the GPU, plain memory for tests and benchmarks.
+class TileUploader
+{
+public:
+	virtual ~TileUploader() {}
+	// copies the RGBA pixels of the tile into its storage - created (or recreated) if the size changed
+	virtual bool Upload(int tile, const cv::Mat& rgba) = 0;
+	// the texture to draw the tile with (nullptr if there is none)
+	virtual void* Texture(int tile) = 0;
+	virtual void Release() = 0; // all tiles
+};
+
+// keeps the uploaded tiles in memory
+class MemoryTileUploader : public TileUploader
+{
+public:
+	bool Upload(int tile, const cv::Mat& rgba) override;
+	void* Texture(int tile) override { return tile < tiles.size() && !tiles[tile].empty() ? tiles[tile].data : nullptr; }
+	void Release() override { tiles.clear(); }
+	const cv::Mat& Tile(int tile) const { return tiles.at(tile); }
+
+	int uploads = 0;
+	int64_t bytes = 0;
+
+private:
+	std::vector<cv::Mat> tiles;
+};
+
+// The displayed frame split into tiles. SetFrame() keeps a copy and marks only the tiles whose pixels changed; 
+// Upload() sends the dirty tiles that are visible (at the current zoom and scroll) to the uploader - the others 
+// stay dirty until they get visible. So a small ROI change uploads a few tiles, and images of any size can be shown.
+class DisplaySurface
+{
+public:
+	DisplaySurface() {}
+	// the surface of the image window
+	static DisplaySurface& Main() {
+		static DisplaySurface surface;
+		return surface;
+	}
+
+	// a frame of another size resets all tiles
+	void SetFrame(const cv::Mat& rgba);
+	// only the regions may have changed (e.g. the updated tiles of the overlay)
+	void SetFrame(const cv::Mat& rgba, const std::vector<cv::Rect>& changed);
+	// the kept frame to render into directly (reset if it has another size) - mark the written regions afterwards
+	cv::Mat& Frame(cv::Size size);
+	void MarkDirty(cv::Rect rect);
+	void MarkAllDirty();
+	// returns the number of uploaded tiles
+	int Upload(cv::Rect visible, TileUploader& uploader);
+
+	cv::Size Size() const { return frame.size(); }
+	int TileCount() const { return static_cast<int>(dirty.size()); }
+	cv::Rect TileRect(int tile) const;
+	std::vector<int> TilesIn(cv::Rect rect) const;
+
+	struct Counters {
+		int frames = 0;
+		int changedTiles = 0;
+		int uploadedTiles = 0;
+		int64_t uploadedBytes = 0;
+	};
+	Counters counters;
+
+private:
+	void reset(cv::Size size);
+	bool updateTile(int tile, const cv::Mat& rgba);
+
+	cv::Mat frame; // copy of the last frame - the source of the uploads
+	std::vector<uchar> dirty;
+	int tilesX = 0;
+	TrackedBytes trackedBytes{ MemoryOwner::Display };
+};
+
+// small ROI change and full frame change with a memory uploader at the given size - prints to the console
+void BenchmarkDisplaySurface(int rows, int cols);
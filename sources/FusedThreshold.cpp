@@ -0,0 +1,186 @@
+/*
+ * This file is part of PixLabelCV.
+ *
+ * Copyright (C) 2024 Dominik Schraml
+ *
+ * PixLabelCV is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Alternatively, commercial licenses are available. Please contact SQB Ilmenau
+ * at olaf.glaessner@sqb-ilmenau.de or dominik.schraml@sqb-ilmenau.de for more details.
+ *
+ * PixLabelCV is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PixLabelCV. If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include "FusedThreshold.h"
+#include "opencv2/imgproc.hpp"
+#include "opencv2/core/hal/intrin.hpp"
+#include <iostream>
+#include "Timer.h"
+
+using namespace cv;
+
+namespace {
+
+enum Predicate { InRangeBGR, InRangeHSV, FromMask };
+
+inline uchar blend(uchar pixel, int colorTimesAlpha, int inverseAlpha) {
+	return static_cast<uchar>((pixel * inverseAlpha + colorTimesAlpha + 128) >> 8);
+}
+
+// rows of the ROI: the predicate decides per pixel, the output is written unless Fill (only the mask then)
+template<Predicate P, bool Fill>
+void thresholdRows(const Range& rows, const Mat& bgr, const ThresholdRange& range, Vec3b color, int alpha, Mat& mask, Mat& rgba) {
+	const int cols = bgr.cols;
+	const int inverse = 256 - alpha;
+	const int colorB = color[0] * alpha, colorG = color[1] * alpha, colorR = color[2] * alpha;
+	Mat hsvRow;
+	for(int y = rows.start; y < rows.end; y++) {
+		const uchar* src = bgr.ptr<uchar>(y);
+		const uchar* values = src; // the channels the range is tested on
+		if constexpr(P == InRangeHSV) {
+			cvtColor(bgr.row(y), hsvRow, COLOR_BGR2HSV); // one row - stays in the cache
+			values = hsvRow.ptr<uchar>();
+		}
+		uchar* m = mask.ptr<uchar>(y);
+		uchar* dst = Fill ? nullptr : rgba.ptr<uchar>(y);
+		int x = 0;
+#if (CV_SIMD || CV_SIMD_SCALABLE)
+		const int lanes = VTraits<v_uint8>::vlanes();
+		const v_uint8 low0 = vx_setall_u8(saturate_cast<uchar>(range.low[0])), high0 = vx_setall_u8(saturate_cast<uchar>(range.high[0]));
+		const v_uint8 low1 = vx_setall_u8(saturate_cast<uchar>(range.low[1])), high1 = vx_setall_u8(saturate_cast<uchar>(range.high[1]));
+		const v_uint8 low2 = vx_setall_u8(saturate_cast<uchar>(range.low[2])), high2 = vx_setall_u8(saturate_cast<uchar>(range.high[2]));
+		const v_uint16 vInverse = vx_setall_u16(static_cast<ushort>(inverse));
+		const v_uint16 vB = vx_setall_u16(static_cast<ushort>(colorB)), vG = vx_setall_u16(static_cast<ushort>(colorG)),
+			vR = vx_setall_u16(static_cast<ushort>(colorR));
+		const v_uint8 opaque = vx_setall_u8(255);
+		auto vblend = [&](const v_uint8& pixel, const v_uint16& colorTimesAlpha) {
+			v_uint16 lo, hi;
+			v_expand(pixel, lo, hi);
+			return v_rshr_pack<8>(v_add(v_mul_wrap(lo, vInverse), colorTimesAlpha), v_add(v_mul_wrap(hi, vInverse), colorTimesAlpha));
+		};
+		for(; x <= cols - lanes; x += lanes) {
+			v_uint8 b, g, r;
+			if constexpr(!Fill || P == InRangeBGR)
+				v_load_deinterleave(src + 3 * x, b, g, r);
+			v_uint8 in;
+			if constexpr(P == FromMask) {
+				in = v_ne(vx_load(m + x), vx_setzero_u8());
+			} else {
+				v_uint8 c0, c1, c2;
+				if constexpr(P == InRangeHSV)
+					v_load_deinterleave(values + 3 * x, c0, c1, c2);
+				else {
+					c0 = b; c1 = g; c2 = r;
+				}
+				in = v_and(v_and(v_and(v_ge(c0, low0), v_le(c0, high0)), v_and(v_ge(c1, low1), v_le(c1, high1))),
+						   v_and(v_ge(c2, low2), v_le(c2, high2)));
+				v_store(m + x, in);
+			}
+			if constexpr(!Fill)
+				v_store_interleave(dst + 4 * x, v_select(in, vblend(r, vR), r), v_select(in, vblend(g, vG), g),
+								   v_select(in, vblend(b, vB), b), opaque);
+		}
+#endif
+		for(; x < cols; x++) {
+			const uchar* p = src + 3 * x;
+			bool in;
+			if constexpr(P == FromMask) {
+				in = m[x] != 0;
+			} else {
+				const uchar* c = values + 3 * x;
+				in = c[0] >= range.low[0] && c[0] <= range.high[0] && c[1] >= range.low[1] && c[1] <= range.high[1]
+					&& c[2] >= range.low[2] && c[2] <= range.high[2];
+				m[x] = in ? 255 : 0;
+			}
+			if constexpr(!Fill) {
+				uchar* d = dst + 4 * x;
+				d[0] = in ? blend(p[2], colorR, inverse) : p[2];
+				d[1] = in ? blend(p[1], colorG, inverse) : p[1];
+				d[2] = in ? blend(p[0], colorB, inverse) : p[0];
+				d[3] = 255;
+			}
+		}
+	}
+}
+
+template<Predicate P, bool Fill>
+void runKernel(const Mat& bgr, const ThresholdRange& range, Vec3b color, float alpha, Mat& mask, Mat& rgba) {
+	const int a = cvRound(std::min(std::max(alpha, 0.0f), 1.0f) * 256);
+	parallel_for_(Range(0, bgr.rows), [&](const Range& rows) {
+		thresholdRows<P, Fill>(rows, bgr, range, color, a, mask, rgba);
+	});
+}
+
+}
+
+
+void ThresholdBlendRGBA(const cv::Mat& bgr, const ThresholdRange& range, bool hsv, bool fill, cv::Vec3b colorBGR, float alpha,
+						cv::Mat& mask, cv::Mat& rgba) {
+	CV_Assert(bgr.type() == CV_8UC3 && (fill || (rgba.type() == CV_8UC4 && rgba.size() == bgr.size())));
+	mask.create(bgr.size(), CV_8U);
+	if(hsv) {
+		if(fill) runKernel<InRangeHSV, true>(bgr, range, colorBGR, alpha, mask, rgba);
+		else runKernel<InRangeHSV, false>(bgr, range, colorBGR, alpha, mask, rgba);
+	} else {
+		if(fill) runKernel<InRangeBGR, true>(bgr, range, colorBGR, alpha, mask, rgba);
+		else runKernel<InRangeBGR, false>(bgr, range, colorBGR, alpha, mask, rgba);
+	}
+}
+
+void BlendMaskRGBA(const cv::Mat& bgr, const cv::Mat& mask, cv::Vec3b colorBGR, float alpha, cv::Mat& rgba) {
+	CV_Assert(bgr.type() == CV_8UC3 && mask.type() == CV_8U && mask.size() == bgr.size()
+			  && rgba.type() == CV_8UC4 && rgba.size() == bgr.size());
+	Mat m = mask; // read only here
+	runKernel<FromMask, false>(bgr, ThresholdRange(), colorBGR, alpha, m, rgba);
+}
+
+
+void BenchmarkThresholdKernel(int rows, int cols) {
+	if(rows <= 0 || cols <= 0) return;
+	Mat bgr(rows, cols, CV_8UC3);
+	randu(bgr, 0, 256);
+	const ThresholdRange range = { { 50, 60, 70 }, { 180, 190, 200 } };
+	const Vec3b color(0, 128, 255);
+	const float alpha = 0.5f;
+	Mat mask, rgba(rows, cols, CV_8UC4);
+	{
+		std::cout << "threshold preview with inRange, setTo, addWeighted, cvtColor: ";
+		Timer timer;
+		Mat inRangeMask, classRegion, blended;
+		inRange(bgr, Scalar(range.low[0], range.low[1], range.low[2]), Scalar(range.high[0], range.high[1], range.high[2]), inRangeMask);
+		bgr.copyTo(classRegion);
+		classRegion.setTo(Scalar(color[0], color[1], color[2]), inRangeMask);
+		addWeighted(classRegion, alpha, bgr, 1.0 - alpha, 0.0, blended);
+		cvtColor(blended, rgba, COLOR_BGR2RGBA);
+	}
+	{
+		std::cout << "fused threshold kernel (RGB): ";
+		Timer timer;
+		ThresholdBlendRGBA(bgr, range, false, false, color, alpha, mask, rgba);
+	}
+	{
+		std::cout << "with HSV conversion: ";
+		Timer timer;
+		Mat hsv, inRangeMask, classRegion, blended;
+		cvtColor(bgr, hsv, COLOR_BGR2HSV);
+		inRange(hsv, Scalar(range.low[0], range.low[1], range.low[2]), Scalar(range.high[0], range.high[1], range.high[2]), inRangeMask);
+		bgr.copyTo(classRegion);
+		classRegion.setTo(Scalar(color[0], color[1], color[2]), inRangeMask);
+		addWeighted(classRegion, alpha, bgr, 1.0 - alpha, 0.0, blended);
+		cvtColor(blended, rgba, COLOR_BGR2RGBA);
+	}
+	{
+		std::cout << "fused threshold kernel (HSV): ";
+		Timer timer;
+		ThresholdBlendRGBA(bgr, range, true, false, color, alpha, mask, rgba);
+	}
+}
@@ -0,0 +1,43 @@
+/*
+ * This file is part of PixLabelCV.
+ *
+ * Copyright (C) 2024 Dominik Schraml
+ *
+ * PixLabelCV is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Alternatively, commercial licenses are available. Please contact SQB Ilmenau
+ * at olaf.glaessner@sqb-ilmenau.de or dominik.schraml@sqb-ilmenau.de for more details.
+ *
+ * PixLabelCV is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PixLabelCV. If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include "opencv2/core.hpp"
+
+// Inclusive bounds per channel of the color space the threshold is applied in (BGR or OpenCV's 8 bit HSV).
+struct ThresholdRange
+{
+	int low[3];
+	int high[3];
+};
+
+// One pass over the BGR ROI for the threshold preview - replaces inRange (and cvtColor to HSV), the copy, setTo 
+// of the class color, addWeighted and the RGBA conversion. Writes the class mask (255 in range, else 0) and the 
+// RGBA output (class color blended with alpha over the matched pixels). With fill only the mask is written, as 
+// its inner pixels are filled before it is shown - the output follows with BlendMaskRGBA.
+// mask is allocated with the size of bgr, rgba must have the size of bgr (e.g. a ROI of the display frame).
+void ThresholdBlendRGBA(const cv::Mat& bgr, const ThresholdRange& range, bool hsv, bool fill, cv::Vec3b colorBGR, float alpha,
+						cv::Mat& mask, cv::Mat& rgba);
+// the RGBA output for a given mask
+void BlendMaskRGBA(const cv::Mat& bgr, const cv::Mat& mask, cv::Vec3b colorBGR, float alpha, cv::Mat& rgba);
+
+// compares with inRange, setTo, addWeighted and cvtColor for the given ROI size - prints to the console
+void BenchmarkThresholdKernel(int rows, int cols);
@@ -0,0 +1,341 @@
+/*
+ * This file is part of PixLabelCV.
+ *
+ * Copyright (C) 2024 Dominik Schraml
+ *
+ * PixLabelCV is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Alternatively, commercial licenses are available. Please contact SQB Ilmenau
+ * at olaf.glaessner@sqb-ilmenau.de or dominik.schraml@sqb-ilmenau.de for more details.
+ *
+ * PixLabelCV is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PixLabelCV. If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include "GrabCutSession.h"
+#include "opencv2/imgproc.hpp"
+#include "opencv2/imgcodecs.hpp"
+#include <chrono>
+#include <iostream>
+
+using namespace cv;
+
+static Rect scribbleRect(const Scribble& s) {
+	return Rect(s.center.x - s.radius, s.center.y - s.radius, 2 * s.radius + 1, 2 * s.radius + 1);
+}
+
+void GrabCutSession::Reset() {
+	Cancel();
+	worker.Wait();
+	clear();
+	std::lock_guard<std::mutex> lock(resultMutex);
+	published = Result();
+	taken = 0;
+}
+
+void GrabCutSession::clear() {
+	imageSize = Size();
+	region = Rect();
+	regionImage.release();
+	mask.release();
+	coarseMask.release();
+	bgdModel.release();
+	fgdModel.release();
+	applied.clear();
+	trackedBytes.Set(0);
+}
+
+bool GrabCutSession::canResume(const cv::Mat& image, const std::vector<Scribble>& scribbles) const {
+	if(mask.empty() || image.size() != imageSize || scribbles.size() < applied.size())
+		return false;
+	for(size_t i = 0; i < scribbles.size(); i++) {
+		if(i < applied.size()) {
+			const Scribble& a = applied[i];
+			if(a.center != scribbles[i].center || a.radius != scribbles[i].radius || a.foreground != scribbles[i].foreground)
+				return false;
+		} else if((scribbleRect(scribbles[i]) & region) != scribbleRect(scribbles[i]))
+			return false;
+	}
+	return true;
+}
+
+void GrabCutSession::paint(const std::vector<Scribble>& scribbles, size_t first) {
+	for(size_t i = first; i < scribbles.size(); i++)
+		circle(mask, scribbles[i].center - region.tl(), scribbles[i].radius, Scalar(scribbles[i].foreground ? GC_FGD : GC_BGD), FILLED);
+}
+
+double GrabCutSession::iterate(const cv::Mat& image, cv::Mat& m, int mode) {
+	Mat before;
+	bitwise_and(m, Scalar(1), before); // GC_FGD and GC_PR_FGD are odd
+	grabCut(image, m, Rect(), bgdModel, fgdModel, 1, mode);
+	Mat after;
+	bitwise_and(m, Scalar(1), after);
+	return double(countNonZero(before != after)) / std::max<int64_t>(m.total(), 1);
+}
+
+double GrabCutSession::elapsedMs() const {
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started).count();
+}
+
+bool GrabCutSession::converge(const cv::Mat& image, cv::Mat& m, const GrabCutSettings& settings, const std::function<bool()>& progress) {
+	while(stats.iterations < settings.maxIterations && stats.changed >= settings.convergence && elapsedMs() < settings.budgetMs) {
+		stats.changed = iterate(image, m, GC_EVAL);
+		stats.iterations++;
+		stats.ms = elapsedMs();
+		if(progress && !progress()) return false;
+	}
+	return true;
+}
+
+bool GrabCutSession::start(const GrabCutSettings& settings, const std::function<bool()>& progress) {
+	bgdModel.release();
+	fgdModel.release();
+	const int levels = std::min(std::max(settings.coarseLevels, 0), 6);
+	if(levels == 0 || std::min(region.width, region.height) >> levels < 16) {
+		grabCut(regionImage, mask, Rect(), bgdModel, fgdModel, 1, GC_INIT_WITH_MASK);
+		return false;
+	}
+	// the coarse level with its own mask - the scribbles painted at that scale
+	std::vector<Mat> pyramid;
+	buildPyramid(regionImage, pyramid, levels);
+	const Mat& coarse = pyramid.back();
+	const double scale = double(coarse.cols) / regionImage.cols;
+	resize(mask, coarseMask, coarse.size(), 0, 0, INTER_NEAREST);
+	for(const Scribble& s : applied)
+		circle(coarseMask, Point(cvRound((s.center.x - region.x) * scale), cvRound((s.center.y - region.y) * scale)),
+			   std::max(1, cvRound(s.radius * scale)), Scalar(s.foreground ? GC_FGD : GC_BGD), FILLED);
+	grabCut(coarse, coarseMask, Rect(), bgdModel, fgdModel, 1, GC_INIT_WITH_MASK);
+	// the same stop conditions as at full resolution
+	stats.iterations = 1;
+	stats.changed = 1;
+	stats.ms = elapsedMs();
+	if((progress && !progress()) || !converge(coarse, coarseMask, settings, progress)) {
+		clear(); // the full resolution mask was never segmented
+		return true;
+	}
+	Mat coarseForeground;
+	bitwise_and(coarseMask, Scalar(1), coarseForeground);
+	coarseMask.release();
+	refineBand(coarseForeground, applied, settings);
+	stats.ms = elapsedMs();
+	if(progress) progress();
+	return true;
+}
+
+void GrabCutSession::refineBand(const cv::Mat& coarseForeground, const std::vector<Scribble>& scribbles, const GrabCutSettings& settings) {
+	// upscaled result: definite outside the band, probable inside
+	Mat foreground;
+	resize(coarseForeground, foreground, region.size(), 0, 0, INTER_NEAREST);
+	Mat band;
+	morphologyEx(foreground, band, MORPH_GRADIENT, Mat()); // the boundary pixels
+	const int width = std::max(settings.bandWidth, 1);
+	dilate(band, band, getStructuringElement(MORPH_ELLIPSE, Size(2 * width + 1, 2 * width + 1)));
+	Mat fixedMask(region.size(), CV_8U, Scalar(GC_BGD));
+	fixedMask.setTo(Scalar(GC_FGD), foreground);
+	Mat probable(region.size(), CV_8U, Scalar(GC_PR_BGD));
+	probable.setTo(Scalar(GC_PR_FGD), foreground);
+	probable.copyTo(fixedMask, band);
+	mask.copyTo(fixedMask, (mask == GC_BGD) & band); // the margin stays background
+	mask = fixedMask;
+	paint(scribbles, 0);
+
+	// graph cut only in the tiles the band passes - with the color models of the coarse level, which are not changed
+	const int tileSize = 256, overlap = 8;
+	std::vector<Rect> tiles;
+	for(int y = 0; y < region.height; y += tileSize)
+		for(int x = 0; x < region.width; x += tileSize) {
+			const Rect tile = Rect(x, y, tileSize, tileSize) & Rect(Point(0, 0), region.size());
+			if(countNonZero(band(tile)) > 0) tiles.push_back(tile);
+		}
+	const Mat before = mask.clone();
+	parallel_for_(Range(0, static_cast<int>(tiles.size())), [&](const Range& range) {
+		for(int i = range.start; i < range.end; i++) {
+			const Rect tile = tiles[i];
+			const Rect outer = Rect(tile.x - overlap, tile.y - overlap, tile.width + 2 * overlap, tile.height + 2 * overlap)
+				& Rect(Point(0, 0), region.size());
+			Mat tileMask = before(outer).clone();
+			Mat bgd = bgdModel.clone(), fgd = fgdModel.clone();
+			grabCut(regionImage(outer), tileMask, Rect(), bgd, fgd, 1, GC_EVAL_FREEZE_MODEL);
+			tileMask(tile - outer.tl()).copyTo(mask(tile));
+		}
+	});
+}
+
+cv::Rect GrabCutSession::Run(const cv::Mat& image, const std::vector<Scribble>& scribbles, const GrabCutSettings& settings,
+							 const std::function<bool()>& progress) {
+	started = std::chrono::steady_clock::now();
+	stats = Stats();
+	if(scribbles.empty()) {
+		clear();
+		return region;
+	}
+
+	stats.resumed = canResume(image, scribbles);
+	if(stats.resumed) {
+		paint(scribbles, applied.size());
+		stats.changed = iterate(regionImage, mask, GC_EVAL);
+	} else {
+		// the scribbles' bounding box is probably background, the margin around it definitely
+		Rect box;
+		for(const Scribble& s : scribbles)
+			box |= scribbleRect(s);
+		const Rect bounds(Point(0, 0), image.size());
+		box &= bounds;
+		const int margin = std::max(settings.margin, 0);
+		region = Rect(box.x - margin, box.y - margin, box.width + 2 * margin, box.height + 2 * margin) & bounds;
+		imageSize = image.size();
+		image(region).copyTo(regionImage);
+		mask.create(region.size(), CV_8U);
+		mask.setTo(Scalar(GC_BGD));
+		mask(box - region.tl()).setTo(Scalar(GC_PR_BGD));
+		paint(scribbles, 0);
+		// at least one foreground point must exist (not only background)
+		bool foreground = false;
+		for(const Scribble& s : scribbles)
+			foreground |= s.foreground;
+		if(!foreground)
+			circle(mask, (box.tl() + box.br()) / 2 - region.tl(), 10, Scalar(GC_FGD), FILLED);
+		applied = scribbles;
+		trackedBytes.Set(int64_t(regionImage.total()) * regionImage.elemSize() + int64_t(mask.total()));
+		stats.coarseToFine = start(settings, progress);
+		if(stats.coarseToFine) // iterated at the coarse level already (or stopped)
+			return region;
+		stats.changed = 1;
+	}
+	applied = scribbles;
+	trackedBytes.Set(int64_t(regionImage.total()) * regionImage.elemSize() + int64_t(mask.total()));
+	stats.ms = elapsedMs();
+	stats.iterations = 1;
+	if(progress && !progress())
+		return region;
+
+	// resume until the segmentation is stable or the time is up
+	converge(regionImage, mask, settings, progress);
+	return region;
+}
+
+void GrabCutSession::publish(uint64_t run, bool done) {
+	Result result;
+	result.region = region;
+	ForegroundMask(result.foreground);
+	result.stats = stats;
+	result.done = done;
+	std::lock_guard<std::mutex> lock(resultMutex);
+	if(run != generation) return; // cancelled meanwhile
+	result.version = published.version + 1;
+	published = result;
+}
+
+void GrabCutSession::RunAsync(const cv::Mat& image, const std::vector<Scribble>& scribbles, const GrabCutSettings& settings) {
+	const uint64_t run = ++generation;
+	active = true;
+	worker.Submit([this, run, image, scribbles, settings] {
+		if(run != generation) return; // a newer run is queued
+		Run(image, scribbles, settings, [this, run] {
+			if(run != generation) return false;
+			publish(run, false);
+			return true;
+		});
+		publish(run, true);
+	});
+}
+
+void GrabCutSession::Cancel() {
+	++generation;
+	active = false;
+	// nothing to show anymore
+	std::lock_guard<std::mutex> lock(resultMutex);
+	Result next;
+	next.version = published.version + 1;
+	published = next;
+}
+
+GrabCutSession::Result GrabCutSession::TakeResult() {
+	std::lock_guard<std::mutex> lock(resultMutex);
+	taken = published.version;
+	return published;
+}
+
+bool GrabCutSession::HasNewResult() {
+	std::lock_guard<std::mutex> lock(resultMutex);
+	return published.version != taken;
+}
+
+void GrabCutSession::ForegroundMask(cv::Mat& foreground) const {
+	foreground.create(mask.size(), CV_8U);
+	if(mask.empty()) return;
+	if(!coarseMask.empty()) { // still at the coarse level
+		Mat coarseForeground;
+		bitwise_and(coarseMask, Scalar(1), coarseForeground);
+		resize(coarseForeground, foreground, mask.size(), 0, 0, INTER_NEAREST);
+	} else
+		bitwise_and(mask, Scalar(1), foreground);
+	foreground *= 255;
+}
+
+
+void BenchmarkGrabCut(const std::vector<std::string>& imagePaths, int coarseLevels) {
+	std::vector<std::string> paths = imagePaths;
+	if(paths.empty()) paths.push_back(""); // a random image
+	double fullMs = 0, coarseMs = 0, iouSum = 0;
+	int count = 0;
+	for(const std::string& path : paths) {
+		Mat image;
+		if(path.empty()) {
+			image.create(1024, 1024, CV_8UC3);
+			randu(image, 0, 256);
+			circle(image, Point(512, 512), 200, Scalar(40, 200, 40), FILLED);
+		} else
+			image = imread(path);
+		if(image.empty()) continue;
+		// the same strokes for every image: foreground through the center, background on a box around it
+		std::vector<Scribble> scribbles;
+		const Point center(image.cols / 2, image.rows / 2);
+		const int w = image.cols / 4, h = image.rows / 4;
+		for(int x = -w / 4; x <= w / 4; x += 4)
+			scribbles.push_back({ center + Point(x, 0), 5, true });
+		for(int x = -w; x <= w; x += 8) {
+			scribbles.push_back({ center + Point(x, -h), 5, false });
+			scribbles.push_back({ center + Point(x, h), 5, false });
+		}
+		for(int y = -h; y <= h; y += 8) {
+			scribbles.push_back({ center + Point(-w, y), 5, false });
+			scribbles.push_back({ center + Point(w, y), 5, false });
+		}
+
+		GrabCutSettings settings;
+		settings.budgetMs = 1e9; // the same iterations for both
+		GrabCutSession session; // not the tool's session - that keeps its region and models
+		session.Run(image, scribbles, settings);
+		const double full = session.LastRun().ms;
+		Mat reference;
+		session.ForegroundMask(reference);
+
+		settings.coarseLevels = coarseLevels;
+		session.Reset();
+		session.Run(image, scribbles, settings);
+		const double coarse = session.LastRun().ms;
+		Mat result;
+		session.ForegroundMask(result);
+
+		const int intersection = countNonZero(reference & result), unite = countNonZero(reference | result);
+		const double iou = unite > 0 ? double(intersection) / unite : 1.0;
+		std::cout << (path.empty() ? "random image" : path) << " (" << image.cols << " x " << image.rows << "): full resolution "
+			<< full << " ms, coarse to fine " << coarse << " ms, IoU " << iou << "\n";
+		fullMs += full;
+		coarseMs += coarse;
+		iouSum += iou;
+		count++;
+	}
+	if(count > 0)
+		std::cout << "grabcut " << count << " images: full resolution " << fullMs / count << " ms, coarse to fine (" << coarseLevels
+			<< " levels) " << coarseMs / count << " ms, mean IoU " << iouSum / count << "\n";
+}
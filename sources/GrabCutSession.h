@@ -0,0 +1,142 @@
+/*
+ * This file is part of PixLabelCV.
+ *
+ * Copyright (C) 2024 Dominik Schraml
+ *
+ * PixLabelCV is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Alternatively, commercial licenses are available. Please contact SQB Ilmenau
+ * at olaf.glaessner@sqb-ilmenau.de or dominik.schraml@sqb-ilmenau.de for more details.
+ *
+ * PixLabelCV is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PixLabelCV. If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include "opencv2/core.hpp"
+#include "MemoryTracker.h"
+#include "ThreadPool.h"
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// a stroke point of the GrabCut tool in image coordinates
+struct Scribble
+{
+	cv::Point center;
+	int radius;
+	bool foreground;
+};
+
+struct GrabCutSettings
+{
+	int margin = 32;            // pixels of definite background around the scribbles
+	int maxIterations = 5;
+	double convergence = 0.001; // stop when less than this fraction of the region's pixels changed between fore- and background
+	double budgetMs = 500;      // no further iteration once exceeded
+	// coarse to fine: segments the region halved levels times first, then at full resolution only a band of 
+	// bandWidth pixels around the upscaled boundary - the rest is fixed fore- or background (0 levels: off)
+	int coarseLevels = 0;
+	int bandWidth = 6;
+};
+
+// GrabCut that lives across the evaluations for the same image: keeps the region around the scribbles, its mask 
+// and the color models. New scribbles are painted into the kept mask and the segmentation is resumed (GC_EVAL) 
+// instead of starting over - it starts over when earlier scribbles changed or new ones leave the region.
+class GrabCutSession
+{
+public:
+	static GrabCutSession& Instance() {
+		static GrabCutSession instance;
+		return instance;
+	}
+
+	// returns the region of the mask (empty without scribbles) - progress is called after each iteration, false stops
+	cv::Rect Run(const cv::Mat& image, const std::vector<Scribble>& scribbles, const GrabCutSettings& settings,
+				 const std::function<bool()>& progress = nullptr);
+	void Reset(); // e.g. another image - waits for a background run
+
+	// Runs on the worker thread and publishes the mask after every iteration. A new run cancels the current one
+	// (it stops after its current iteration, its results are dropped). image must stay valid until the run ended.
+	void RunAsync(const cv::Mat& image, const std::vector<Scribble>& scribbles, const GrabCutSettings& settings);
+	void Cancel(); // also drops the published result
+	void Wait() { worker.Wait(); } // for the cancelled run to stop before Run is called directly
+	bool Active() const { return active; } // started in the background and not cancelled
+
+	struct Stats {
+		bool resumed = false;
+		bool coarseToFine = false;
+		int iterations = 0;
+		double changed = 0; // fraction of the region that changed in the last iteration
+		double ms = 0;
+	};
+	struct Result {
+		uint64_t version = 0;
+		cv::Rect region;
+		cv::Mat foreground; // 255 where (probably) foreground - of the region
+		Stats stats;
+		bool done = false;  // the last of the run
+	};
+	// the latest published result of the background run - marks it as taken
+	Result TakeResult();
+	bool HasNewResult();
+
+	cv::Rect Region() const { return region; }
+	const cv::Mat& Mask() const { return mask; } // GC_BGD, GC_FGD, GC_PR_BGD or GC_PR_FGD for the region
+	void ForegroundMask(cv::Mat& foreground) const; // 255 where (probably) foreground
+
+	Stats LastRun() const { return stats; }
+
+private:
+	GrabCutSession() {}
+	GrabCutSession(GrabCutSession const&);  // Don't Implement.
+	void operator = (GrabCutSession const&);  // Don't implement 
+	friend void BenchmarkGrabCut(const std::vector<std::string>& imagePaths, int coarseLevels); // own sessions
+
+	bool canResume(const cv::Mat& image, const std::vector<Scribble>& scribbles) const;
+	void paint(const std::vector<Scribble>& scribbles, size_t first);
+	void clear();
+	void publish(uint64_t run, bool done);
+	// segments the region from the initialized mask - directly or coarse to fine (returns true then, progress is 
+	// called after each coarse iteration and after the band refinement - a stopped coarse run is not resumable)
+	bool start(const GrabCutSettings& settings, const std::function<bool()>& progress);
+	void refineBand(const cv::Mat& coarseForeground, const std::vector<Scribble>& scribbles, const GrabCutSettings& settings);
+	// one iteration of image with its mask m - returns the fraction of the mask that changed
+	double iterate(const cv::Mat& image, cv::Mat& m, int mode);
+	// iterates (GC_EVAL) until the segmentation is stable or the iterations or the time budget are used up, 
+	// at any level - false when progress stopped it
+	bool converge(const cv::Mat& image, cv::Mat& m, const GrabCutSettings& settings, const std::function<bool()>& progress);
+	double elapsedMs() const;
+
+	cv::Size imageSize;
+	cv::Rect region;
+	cv::Mat regionImage; // copy of the image region - grabCut needs the BGR pixels
+	cv::Mat mask;
+	cv::Mat coarseMask; // of the coarse level while it is iterated (ForegroundMask scales it up)
+	cv::Mat bgdModel, fgdModel;
+	std::vector<Scribble> applied; // painted into the mask
+	Stats stats;
+	std::chrono::steady_clock::time_point started; // of the run
+	TrackedBytes trackedBytes{ MemoryOwner::Cache };
+
+	std::atomic<uint64_t> generation{ 0 }; // of the current background run - older ones stop
+	std::atomic<bool> active{ false };
+	std::mutex resultMutex;
+	Result published;
+	uint64_t taken = 0; // version
+	ThreadPool worker{ 1 }; // last member - joined before the state it works on is destroyed
+};
+
+// Latency and IoU of coarse to fine against the full resolution GrabCut on the images (or a random one if empty): 
+// a foreground stroke through the center and background strokes around it - prints to the console
+void BenchmarkGrabCut(const std::vector<std::string>& imagePaths, int coarseLevels);
@@ -29,6 +29,10 @@
 
 #include "ImageProcessing.h"
 #include "LabelState.h"
+#include "BufferPool.h"
+#include "ClassOverlay.h"
+#include "FusedThreshold.h"
+#include "GrabCutSession.h"
 #include "Timer.h"
 #include "imgui.h"
 #include "shapes.h"
@@ -39,6 +43,8 @@ using namespace std;
 
 static UMat currentClassRegion;
 static UMat tempMask;
+static UMat tempLabels;  // CV_16U classes of the last watershed (any number of classes)
+static Rect tempMaskRoi; // the region of tempLabels set by the last watershed
 
 #pragma region helpers
 
@@ -143,28 +149,178 @@ bool fill_mask(UMat classPixelMask) {
 	} else return false;
 }
 
+// passes over the whole image by the last evaluation (copies and conversions) - 1 if only the output is written
+static int fullFrameCopies = 0;
+
+// writes the RGBA output: the image converted outside roi and the result inside - every pixel exactly once
+static void renderRGBA(const UMat& img, Rect roi, const UMat& roiResult, Mat& target) {
+	roi &= Rect(0, 0, img.cols, img.rows);
+	const Mat image = img.getMat(ACCESS_READ);
+	const Rect around[4] = {
+		Rect(0, 0, img.cols, roi.y),                                         // above
+		Rect(0, roi.y + roi.height, img.cols, img.rows - roi.y - roi.height), // below
+		Rect(0, roi.y, roi.x, roi.height),                                   // left
+		Rect(roi.x + roi.width, roi.y, img.cols - roi.x - roi.width, roi.height) // right
+	};
+	if(roi.empty()) {
+		cv::cvtColor(image, target, cv::COLOR_BGR2RGBA);
+	} else {
+		for(const Rect& rect : around) {
+			if(rect.empty()) continue;
+			Mat part = target(rect);
+			cv::cvtColor(image(rect), part, cv::COLOR_BGR2RGBA);
+		}
+		if(!roiResult.empty()) { // else already rendered
+			Mat part = target(roi);
+			cv::cvtColor(roiResult, part, cv::COLOR_BGR2RGBA);
+		}
+	}
+	fullFrameCopies++;
+}
+
+int LastFullFrameCopies() {
+	return fullFrameCopies;
+}
+
+// the largest marker value (class + 1) - every class of the label map can be a marker
+const int MAX_WATERSHED_LABEL = MAX_CLASSES;
+
+// One pass over the watershed result (CV_32S labels of the roi, marker value = class + 1): the inverted class 
+// color blended with alpha over the image into target and the class into classLabels (CV_16U). Boundaries (-1), 
+// background and labels above maxLabel are black and keep classLabels. boundaries (optional) gets 255 on the boundaries.
+static void renderWatershed(const Mat& image, const Mat& labels, Rect roi, int maxLabel, double alpha, Mat& target, Mat& classLabels, Mat* boundaries) {
+	// lookup table for the labels -1 ... maxLabel (the largest marker - not all MAX_WATERSHED_LABEL colors)
+	maxLabel = std::clamp(maxLabel, 0, MAX_WATERSHED_LABEL);
+	std::vector<Vec3b> colors(maxLabel + 2, Vec3b(0, 0, 0));
+	std::vector<int> classes(maxLabel + 2, -1);
+	for(int label = 1; label <= maxLabel; label++) {
+		const Vec3b col = Vec3b(255, 255, 255) - ClassColor(label - 1); // Display with inverted color
+		colors[label + 1] = Vec3b(col[0], col[1], col[2]); // RGB like the target
+		classes[label + 1] = label - 1;
+	}
+	if(boundaries) boundaries->create(labels.size(), CV_8U);
+	const int a = cvRound(std::min(std::max(alpha, 0.0), 1.0) * 256);
+	parallel_for_(Range(0, roi.height), [&](const Range& range) {
+		for(int y = range.start; y < range.end; y++) {
+			const int* l = labels.ptr<int>(y);
+			const uchar* src = image.ptr<uchar>(roi.y + y, roi.x);
+			uchar* dst = target.ptr<uchar>(roi.y + y, roi.x);
+			ushort* cls = classLabels.ptr<ushort>(roi.y + y, roi.x);
+			uchar* b = boundaries ? boundaries->ptr<uchar>(y) : nullptr;
+			for(int x = 0; x < roi.width; x++, src += 3, dst += 4) {
+				const int index = (l[x] < -1 || l[x] > maxLabel) ? 0 : l[x] + 1; // 0: black
+				const Vec3b& c = colors[index];
+				dst[0] = static_cast<uchar>((c[0] * a + src[2] * (256 - a) + 128) >> 8);
+				dst[1] = static_cast<uchar>((c[1] * a + src[1] * (256 - a) + 128) >> 8);
+				dst[2] = static_cast<uchar>((c[2] * a + src[0] * (256 - a) + 128) >> 8);
+				dst[3] = 255;
+				if(classes[index] >= 0) cls[x] = static_cast<ushort>(classes[index]);
+				if(b) b[x] = l[x] == -1 ? 255 : 0;
+			}
+		}
+	});
+	fullFrameCopies++;
+}
+
+// Watershed on a pyramid level (levels times halved), the coarse labels scaled up are the markers at full resolution
+// except in a band around the coarse boundaries - only the tiles with band pixels are flooded again (each in a window
+// a bit larger than the tile, in parallel). labels: CV_32S of the image size.
+static void coarseToFineWatershed(const Mat& image, const std::vector<PointClass>& markers, int radius, int levels, Mat& labels) {
+	std::vector<Mat> pyramid;
+	buildPyramid(image, pyramid, levels);
+	const Mat& coarse = pyramid.back();
+	const double scale = double(coarse.cols) / image.cols;
+	Mat coarseLabels = Mat::zeros(coarse.size(), CV_32S);
+	for(const PointClass& m : markers)
+		circle(coarseLabels, Point(cvRound(m.x * scale), cvRound(m.y * scale)), std::max(1, cvRound(radius * scale)), Scalar(m.activeClass + 1));
+	watershed(coarse, coarseLabels);
+
+	// the band: coarse boundaries widened by one coarse pixel on each side (and the image border watershed sets)
+	Mat band = coarseLabels == -1;
+	dilate(band, band, Mat());
+	resize(coarseLabels, labels, image.size(), 0, 0, INTER_NEAREST);
+	Mat fineBand;
+	resize(band, fineBand, image.size(), 0, 0, INTER_NEAREST);
+	labels.setTo(0, fineBand);
+	for(const PointClass& m : markers)
+		circle(labels, Point(m.x, m.y), radius, Scalar(m.activeClass + 1));
+
+	// the windows read the seeds, each tile writes only its own pixels
+	const Mat seeds = labels.clone();
+	const int margin = 4 << levels; // beyond the band (one coarse pixel wide on each side)
+	const Rect imageRect(0, 0, image.cols, image.rows);
+	std::vector<Rect> tiles;
+	for(int y = 0; y < image.rows; y += TILE_SIZE)
+		for(int x = 0; x < image.cols; x += TILE_SIZE) {
+			const Rect tile = Rect(x, y, TILE_SIZE, TILE_SIZE) & imageRect;
+			if(countNonZero(fineBand(tile)) > 0) tiles.push_back(tile);
+		}
+	parallel_for_(Range(0, static_cast<int>(tiles.size())), [&](const Range& range) {
+		for(int i = range.start; i < range.end; i++) {
+			const Rect& tile = tiles[i];
+			const Rect window = Rect(tile.x - margin, tile.y - margin, tile.width + 2 * margin, tile.height + 2 * margin) & imageRect;
+			Mat windowLabels = seeds(window).clone();
+			watershed(image(window), windowLabels); // marks the window border as boundary - only the tile is kept
+			windowLabels(tile - window.tl()).copyTo(labels(tile));
+		}
+	});
+}
+
 
 /// Use the ImageProcParameters (roi, thresholds etc.) to calulate the region of the current class and add them to a temporary mask
 /// [for the user to decide afterwards whether he wants to add the region to the class]
-cv::UMat ApplyCVOperation(ImageProcParameters params, float* color, CvOperation op) {
+/// The RGBA result is written into target (e.g. a mapped texture - any row pitch) which must have the size of the 
+/// image, otherwise nothing is done and false returned. changed is the region that differs from the plain image.
+bool ApplyCVOperation(ImageProcParameters params, float* color, CvOperation op, cv::Mat& target, cv::Rect& changed) {
 	Timer timer;
 	cv::UMat img = LabelState::Instance().GetCurrentImg();
 	int height = img.rows;
 	int width = img.cols;
-	UMat image_rgba;
+	fullFrameCopies = 0;
+	// full size temporaries come from the pool - after the first evaluation nothing is allocated for them
+	BufferPool& pool = BufferPool::Instance();
+	const BufferPool::Counters poolBefore = pool.Totals();
+	// copy of the image to draw the result on (imgToDisplay because else the original image is changed)
+	auto copyOfImage = [&](const char* slot) {
+		UMat copy = pool.GetUMat(slot, img.size(), img.type());
+		img.copyTo(copy);
+		fullFrameCopies++;
+		return copy;
+	};
+	// all zero mask of the image size
+	auto zeroMask = [&](const char* slot, int type) {
+		UMat mask = pool.GetUMat(slot, img.size(), type);
+		mask.setTo(Scalar::all(0));
+		return mask;
+	};
 
 	// if image was deleted meanwhile - or other failures occured
     if (height <= 0 && width <= 0) {
         img = CreateDefaultTextImg(
 			"There is no image here. Probably it was removed!?")
 			.getUMat(ACCESS_RW); 
-        UMat imgToDisplay = img.clone(); 
-		cv::cvtColor(imgToDisplay, image_rgba, cv::COLOR_BGR2RGBA);
-		return image_rgba; 
+		if(target.size() != img.size() || target.type() != CV_8UC4) return false;
+		cv::cvtColor(img, target, cv::COLOR_BGR2RGBA);
+		changed = Rect(0, 0, img.cols, img.rows);
+		return true; 
 	}	
+	if(target.size() != img.size() || target.type() != CV_8UC4) return false;
+	changed = Rect();
+
+	// the image copy and the temporary mask - only what the pool does not hold yet (evicts history and caches if needed)
+	const int64_t missing = pool.MissingBytes("roi", img.size(), img.type()) + pool.MissingBytes("tempMask", img.size(), CV_8U);
+	if(missing > 0 && !MemoryTracker::Instance().Reserve(missing)) {
+		// refused - only the plain image is shown (the UI warns about the shortfall)
+		cv::cvtColor(img, target, cv::COLOR_BGR2RGBA);
+		changed = Rect(0, 0, img.cols, img.rows);
+		tempMask.release();
+		tempLabels.release();
+		return true;
+	}
 
 	// reset temp classPixelMask !
-	tempMask = cv::UMat::zeros(LabelState::Instance().h(), LabelState::Instance().w(), CV_8U);
+	tempMask = zeroMask("tempMask", CV_8U);
+	tempLabels.release(); // only a watershed sets the classes
 	UMat classPixelMask; 
 
 #pragma region ThresholdOrReplace
@@ -186,93 +342,134 @@ cv::UMat ApplyCVOperation(ImageProcParameters params, float* color, CvOperation
 			if (RectRoi.width == 0) RectRoi.width = 1;
 			if (RectRoi.height == 0) RectRoi.height = 1;
  
-			// Work on the current Region only
-			imgRoi = img(RectRoi).clone();
-
-			if (op == ReplaceClass) {
-                // get the label 
-				UMat oldclass = LabelState::Instance().GetClassRegion(params.pixelClassToReplace);
-                // add the label to the currently selected class mask
-                classPixelMask = oldclass(RectRoi).clone();
-            } 
-			else { // threshold
-
+			if(op != ReplaceClass && params.fusedThreshold) {
+				// one pass: the mask and the blended RGBA output directly in the target
+				ThresholdRange range;
 				if(params.isHSV) {
-					int low_h = floor(params.H * 180 + 0.5);
-					int low_s = floor(params.S * 255 + 0.5);
-					int low_v = floor(params.V * 255 + 0.5);
-					UMat imgRoiHSV;
-					// Convert from BGR to HSV colorspace
-					cvtColor(imgRoi, imgRoiHSV, COLOR_BGR2HSV);
-
-					// Detect the object based on HSV Range Values
-					inRange(imgRoiHSV, Scalar(low_h, low_s, low_v),
-							Scalar(floor(params.up_HorR * 180 / 255 + 0.5), params.up_SorG,
-							params.up_VorB), classPixelMask);
+					range = { { int(floor(params.H * 180 + 0.5)), int(floor(params.S * 255 + 0.5)), int(floor(params.V * 255 + 0.5)) },
+							  { int(floor(params.up_HorR * 180 / 255 + 0.5)), params.up_SorG, params.up_VorB } };
 				} else {
-					// apply segmentation to the image region
-					inRange(imgRoi, Scalar(thresh_b, thresh_g, thresh_r),
-							Scalar(params.up_VorB, params.up_SorG, params.up_HorR),
-							classPixelMask);
+					range = { { thresh_b, thresh_g, thresh_r }, { params.up_VorB, params.up_SorG, params.up_HorR } };
 				}
-				if((op & FillMask) == FillMask)
-					fill_mask(classPixelMask);
-			}
-
-			// save the classPixelMask correctly to the temporary mask
-			// this mask is the size of the complete image and can be added by the
-			// user to the classes segmentation result (pressing 'A' button)
-			classPixelMask.copyTo(tempMask(RectRoi));
-
-			// Color to display the results
-			Vec3b col = colors2.at(LabelState::Instance().GetActiveClass());
-			Scalar classColor = Scalar(col[2], col[1], col[0]);
+				// filling and closing change the mask before it is shown
+				const bool postprocess = (op & FillMask) == FillMask || LabelState::Instance().FillRegion;
+				const Vec3b col = ClassColor(LabelState::Instance().GetActiveClass());
+				const Vec3b colorBGR(col[2], col[1], col[0]);
+				Mat mask;
+				{
+					const Mat image = img.getMat(ACCESS_READ);
+					Mat out = target(RectRoi);
+					ThresholdBlendRGBA(image(RectRoi), range, params.isHSV, postprocess, colorBGR, params.alpha_display, mask, out);
+				}
+				if(!postprocess) {
+					mask.copyTo(tempMask(RectRoi));
+				} else {
+					mask.copyTo(classPixelMask);
+					if((op & FillMask) == FillMask)
+						fill_mask(classPixelMask);
+					classPixelMask.copyTo(tempMask(RectRoi));
+					if(LabelState::Instance().FillRegion) {
+						cv::UMat erodeCirc1 = getStructuringElement(
+							MORPH_ELLIPSE, Size(LabelState::Instance().FillSize, LabelState::Instance().FillSize)).getUMat(ACCESS_RW);
+						UMat im_morphed;
+						morphologyEx(classPixelMask, im_morphed, MORPH_CLOSE, erodeCirc1);
+						morphologyEx(im_morphed, im_morphed, MORPH_OPEN, erodeCirc1);
+						classPixelMask = im_morphed;
+					}
+					const Mat image = img.getMat(ACCESS_READ);
+					Mat out = target(RectRoi);
+					BlendMaskRGBA(image(RectRoi), classPixelMask.getMat(ACCESS_READ), colorBGR, params.alpha_display, out);
+				}
+				// imgRoi stays empty - the ROI of the target is already written
+			} else {
+				// Work on the current Region only
+				imgRoi = img(RectRoi).clone();
 
-			// Alt: UMat classRegion = UMat(imgRoi); UMat classRegion = imgRoi; 
-			// invalid --> both still reference and change imgRoi !!
-			UMat classRegion(
-				imgRoi.rows, imgRoi.cols, CV_8UC3,
-				Scalar(0, 0, 0));  // displayed result img is a bit darker in the ROI!
+				if (op == ReplaceClass) {
+					// get the label 
+					UMat oldclass = LabelState::Instance().GetClassRegion(params.pixelClassToReplace);
+					// add the label to the currently selected class mask
+					classPixelMask = oldclass(RectRoi).clone();
+				} 
+				else { // threshold
+
+					if(params.isHSV) {
+						int low_h = floor(params.H * 180 + 0.5);
+						int low_s = floor(params.S * 255 + 0.5);
+						int low_v = floor(params.V * 255 + 0.5);
+						UMat imgRoiHSV;
+						// Convert from BGR to HSV colorspace
+						cvtColor(imgRoi, imgRoiHSV, COLOR_BGR2HSV);
+
+						// Detect the object based on HSV Range Values
+						inRange(imgRoiHSV, Scalar(low_h, low_s, low_v),
+								Scalar(floor(params.up_HorR * 180 / 255 + 0.5), params.up_SorG,
+								params.up_VorB), classPixelMask);
+					} else {
+						// apply segmentation to the image region
+						inRange(imgRoi, Scalar(thresh_b, thresh_g, thresh_r),
+								Scalar(params.up_VorB, params.up_SorG, params.up_HorR),
+								classPixelMask);
+					}
+					if((op & FillMask) == FillMask)
+						fill_mask(classPixelMask);
+				}
 
-			imgRoi.copyTo(classRegion);  // prevents the darkening in the blended ROI
+				// save the classPixelMask correctly to the temporary mask
+				// this mask is the size of the complete image and can be added by the
+				// user to the classes segmentation result (pressing 'A' button)
+				classPixelMask.copyTo(tempMask(RectRoi));
 
-			// apply closing with circle size defined in gui
-			if(LabelState::Instance().FillRegion ==
-			   true) {  // just toggle filling with normal thresholding
+				// Color to display the results
+				Vec3b col = ClassColor(LabelState::Instance().GetActiveClass());
+				Scalar classColor = Scalar(col[2], col[1], col[0]);
 
-				// Get region
-				UMat im_in = classPixelMask;
-				
-				// use morphilogic operators
-				//cv::Mat tempMat = getStructuringElement(
-				//	MORPH_ELLIPSE, Size(LabelState::Instance().FillSize, LabelState::Instance().FillSize));
-				cv::UMat erodeCirc1 = getStructuringElement(
-					MORPH_ELLIPSE, Size(LabelState::Instance().FillSize, LabelState::Instance().FillSize)).getUMat(ACCESS_RW);
+				// Alt: UMat classRegion = UMat(imgRoi); UMat classRegion = imgRoi; 
+				// invalid --> both still reference and change imgRoi !!
+				UMat classRegion(
+					imgRoi.rows, imgRoi.cols, CV_8UC3,
+					Scalar(0, 0, 0));  // displayed result img is a bit darker in the ROI!
 
-				UMat im_morphed;
-				morphologyEx(im_in, im_morphed, MORPH_CLOSE, erodeCirc1);
-				morphologyEx(im_morphed, im_morphed, MORPH_OPEN, erodeCirc1); 
-				classPixelMask = im_morphed;
-			}  // END closing
+				imgRoi.copyTo(classRegion);  // prevents the darkening in the blended ROI
 
+				// apply closing with circle size defined in gui
+				if(LabelState::Instance().FillRegion ==
+				   true) {  // just toggle filling with normal thresholding
 
-			classRegion.setTo(classColor, classPixelMask);
-			addWeighted(classRegion, params.alpha_display, imgRoi,
-						(1.0 - params.alpha_display), 0.0, imgRoi);
+					// Get region
+					UMat im_in = classPixelMask;
+				
+					// use morphilogic operators
+					//cv::Mat tempMat = getStructuringElement(
+					//	MORPH_ELLIPSE, Size(LabelState::Instance().FillSize, LabelState::Instance().FillSize));
+					cv::UMat erodeCirc1 = getStructuringElement(
+						MORPH_ELLIPSE, Size(LabelState::Instance().FillSize, LabelState::Instance().FillSize)).getUMat(ACCESS_RW);
+
+					UMat im_morphed;
+					morphologyEx(im_in, im_morphed, MORPH_CLOSE, erodeCirc1);
+					morphologyEx(im_morphed, im_morphed, MORPH_OPEN, erodeCirc1); 
+					classPixelMask = im_morphed;
+				}  // END closing
+
+
+				classRegion.setTo(classColor, classPixelMask);
+				addWeighted(classRegion, params.alpha_display, imgRoi,
+							(1.0 - params.alpha_display), 0.0, imgRoi);
+			}
 
 		} else if(params.roi_shape == BrushD) {
 
 			// imRoi has to be set to the whole image (maybe later check if faster to reduce according to the painted points)
 			RectRoi = Rect(cv::Point2i(0, 0),
 						   cv::Point2i(img.cols, img.rows));
-			imgRoi = img.clone();
+			imgRoi = copyOfImage("roi");
 
 			// sort and see if time is better
 			std::vector<PointRad> vec_sorted = params.PnR;
 			std::stable_sort(params.PnR.begin(), params.PnR.end(),
 							 compare_only_second);  // works, but might be not neccessary
 
-			classPixelMask = UMat::zeros(img.size(), CV_8U);
+			classPixelMask = zeroMask("classPixelMask", CV_8U);
 			for(auto p : params.PnR) {
 				circle(classPixelMask, Point(p.pt.x, p.pt.y), p.rad, (255), -1);
 			}
@@ -281,7 +478,7 @@ cv::UMat ApplyCVOperation(ImageProcParameters params, float* color, CvOperation
 			classPixelMask.copyTo(tempMask);
 
 			// Color to display the results
-			Vec3b col = colors2.at(LabelState::Instance().GetActiveClass());
+			Vec3b col = ClassColor(LabelState::Instance().GetActiveClass());
 			Scalar classColor = Scalar(col[2], col[1], col[0]);
 
 			// create a 3-channel black image
@@ -354,7 +551,7 @@ cv::UMat ApplyCVOperation(ImageProcParameters params, float* color, CvOperation
 					cvPts.push_back(cvP);
 				}
 				// create a binary mask of the polygons area
-				UMat polyMask = UMat::zeros(img.size(), CV_8U);
+				UMat polyMask = zeroMask("polyMask", CV_8U);
 				//UMat polyMask = UMat::zeros(img.size(), CV_8UC3);
 				fillPoly(polyMask, cvPts, Scalar::all(255));
 
@@ -397,7 +594,7 @@ cv::UMat ApplyCVOperation(ImageProcParameters params, float* color, CvOperation
 			classPixelMask.copyTo(tempMask(RectRoi));
 
 			// Color to display the results
-			Vec3b col = colors2.at(LabelState::Instance().GetActiveClass());
+			Vec3b col = ClassColor(LabelState::Instance().GetActiveClass());
 			Scalar classColor = Scalar(col[2], col[1], col[0]);
 
 			UMat classRegion(
@@ -417,71 +614,57 @@ cv::UMat ApplyCVOperation(ImageProcParameters params, float* color, CvOperation
 
 			// DS: either use polygon points for watershed or just the center of a rectangle! --> + Mouse key
 			RectRoi = Rect(0, 0, img.cols, img.rows);
-			imgRoi = img.clone();
-			UMat markers = UMat::zeros(imgRoi.size(), CV_32S);
-
-			for(auto m_tuple : params.markers) {
-				// start counting the classes at 1, because watershed does count 0 as nothing
-				circle(markers, Point(m_tuple.x, m_tuple.y), 10, Scalar(m_tuple.activeClass + 1));
+			const int markerRadius = 10;
+			if(params.watershedMode == WatershedMarkersRoi && !params.markers.empty()) {
+				Rect box;
+				for(auto m_tuple : params.markers)
+					box |= Rect(m_tuple.x - markerRadius, m_tuple.y - markerRadius, 2 * markerRadius + 1, 2 * markerRadius + 1);
+				const int margin = std::max(params.watershedMargin, 0);
+				box = Rect(box.x - margin, box.y - margin, box.width + 2 * margin, box.height + 2 * margin) & RectRoi;
+				if(!box.empty()) RectRoi = box;
 			}
-			watershed(imgRoi, markers);  
-
-#pragma region UsingUMatWS
-
-			// Create masks based on conditions
-			cv::UMat mask1, mask2, mask3;
-			cv::compare(markers, -1, mask1, cv::CMP_EQ);
-			cv::UMat condition2a, condition2b;
-			cv::compare(markers, 0, condition2a, cv::CMP_LE);
-			cv::compare(markers, 500, condition2b, cv::CMP_GT);
-			cv::bitwise_or(condition2a, condition2b, mask2);
-
-			cv::bitwise_or(mask1, mask2, mask3);
-			cv::bitwise_not(mask3, mask3); // Invert to get the third condition
-
-			// Apply conditions to imgRoi using masks
-			imgRoi.setTo(cv::Scalar(255, 255, 255), mask1); 
-			imgRoi.setTo(cv::Scalar(0, 0, 0), mask2);
-
-			// For the third condition, we need to loop over the unique indices 
-			// in markers since we can't vectorize the color lookup from colors2. 
-			cv::Mat uniqueIndices = markers.getMat(cv::ACCESS_READ).reshape(1, 1); // Flatten and convert to Mat for unique operation
-			std::vector<int> uniqueVec;
-			uniqueVec.reserve(uniqueIndices.total());
-			for(int i = 0; i < uniqueIndices.total(); i++) {
-				int val = uniqueIndices.at<int>(i);
-				if(std::find(uniqueVec.begin(), uniqueVec.end(), val) == uniqueVec.end())
-					uniqueVec.push_back(val);
-			}
-
-			for(int val : uniqueVec) {
-				if(val > 0 && val <= 500) {
-					cv::UMat currentMask, combinedMask;
-					cv::compare(markers, val, currentMask, cv::CMP_EQ);
-
-					cv::Mat DBG_currentMask = currentMask.getMat(ACCESS_READ); 
-					cv::bitwise_and(currentMask, mask3, combinedMask);
-					// get the right class color
-					Vec3b col = colors2.at(val -1);
-					// Display with inverted color
-					Vec3b invertedCol = Vec3b(255, 255, 255) - col; // Invert the color
-					imgRoi.setTo(cv::Scalar(invertedCol[2], invertedCol[1], invertedCol[0]), combinedMask); // notice BGR 
-					tempMask.setTo(val - 1, combinedMask);
+			tempMaskRoi = RectRoi;
+
+			static const char* modeNames[] = { "full image", "markers ROI", "coarse to fine" };
+			std::cout << "watershed " << modeNames[std::clamp(params.watershedMode, 0, 2)] << " (" << RectRoi.width << " x " << RectRoi.height << "): ";
+			UMat markers;
+			Mat coarseLabels; // coarse to fine works on the CPU
+			{
+				Timer watershedTimer;
+				if(params.watershedMode == WatershedCoarseToFine) {
+					coarseLabels = pool.GetMat("markers", img.size(), CV_32S);
+					coarseToFineWatershed(img.getMat(ACCESS_READ), params.markers, markerRadius, std::max(params.watershedLevels, 1), coarseLabels);
+				} else {
+					markers = RectRoi == Rect(0, 0, img.cols, img.rows) ? zeroMask("markers", CV_32S) : UMat(RectRoi.size(), CV_32S, Scalar(0));
+					for(auto m_tuple : params.markers) {
+						// start counting the classes at 1, because watershed does count 0 as nothing
+						circle(markers, Point(m_tuple.x - RectRoi.x, m_tuple.y - RectRoi.y), markerRadius, Scalar(m_tuple.activeClass + 1));
+					}
+					watershed(img(RectRoi), markers); // the image is only read
 				}
 			}
 
+#pragma region UsingUMatWS
+			// labels to colors and classes in one pass, directly into the target - independent of the number of markers
+			{
+				std::cout << "watershed result to display: ";
+				Timer labelsTimer;
+				const Mat image = img.getMat(ACCESS_READ);
+				const Mat labels = markers.empty() ? coarseLabels : markers.getMat(ACCESS_READ);
+				int maxLabel = 0;
+				for(const PointClass& m : params.markers)
+					maxLabel = std::max(maxLabel, m.activeClass + 1);
+				tempLabels = zeroMask("tempLabels", CV_16U);
+				Mat classLabels = tempLabels.getMat(ACCESS_RW);
+				renderWatershed(image, labels, RectRoi, maxLabel, params.alpha_display, target, classLabels, nullptr);
+			}
+			// imgRoi stays empty - the ROI of the target is already written
 #pragma endregion UsingUMatWS
-
-			// Blend image with resulting class colors
-			addWeighted(imgRoi, params.alpha_display, img,
-						(1.0 - params.alpha_display), 0.0, imgRoi);
 		}
 
-		// Display Image to result image in GUI - and else the original image would be changed
-		UMat imgToDisplay = img.clone();
-		// copy result in ROI to Display image and add alpha
-		imgRoi.copyTo(imgToDisplay(RectRoi));
-		cv::cvtColor(imgToDisplay, image_rgba, cv::COLOR_BGR2RGBA);
+		// the result in the ROI, the image elsewhere - the original image is not changed
+		renderRGBA(img, RectRoi, imgRoi, target);
+		changed = RectRoi;
 	}
 #pragma endregion Threshold
 
@@ -500,7 +683,8 @@ cv::UMat ApplyCVOperation(ImageProcParameters params, float* color, CvOperation
 				cvPts.push_back(cvP);
 			}
 			// create a binary mask of the polygons area
-			polyMask = Mat::zeros(img.size(), CV_8U);
+			polyMask = pool.GetMat("polyMask", img.size(), CV_8U);
+			polyMask.setTo(Scalar::all(0));
 			fillPoly(polyMask, cvPts, Scalar::all(255));
 			// get the smallest bounding rectangle 
 			RectRoi = boundingRect(cvPts);
@@ -560,7 +744,7 @@ cv::UMat ApplyCVOperation(ImageProcParameters params, float* color, CvOperation
 				int g = (unsigned)theRNG() & 255;
 				int r = (unsigned)theRNG() & 255;*/
 
-		Vec3b col = colors2.at(LabelState::Instance().GetActiveClass());
+		Vec3b col = ClassColor(LabelState::Instance().GetActiveClass());
 		//Scalar newVal = !params.ff.use_gray_img ? Scalar(col[2], col[1], col[0]) : Scalar(col[2] * 0.299 + col[1] * 0.587 + col[0] * 0.114);
 		Scalar colBGR = Scalar(col[2], col[1], col[0]);
 
@@ -601,120 +785,73 @@ cv::UMat ApplyCVOperation(ImageProcParameters params, float* color, CvOperation
 		// user to the classes segmentation result (pressing 'A' button)
 		classPixelMask.copyTo(tempMask(RectRoi));
 
-		UMat imgToDisplay = img.clone();
-		// copy result in ROI to Display image and add alpha
-		imgRoi.copyTo(imgToDisplay(RectRoi));
-		cv::cvtColor(imgToDisplay, image_rgba, cv::COLOR_BGR2RGBA);
+		renderRGBA(img, RectRoi, imgRoi, target);
+		changed = RectRoi;
 	} 
 	else if( op == GrabCut) {
-		// 25.1.24 DS: GrabCut is not implemented with UMat as of opencv 4.6.0 (asserts type=Mat for the input parameters)
-
-		int distance_from_border = 10; 
-		// init rect for default INIT_WITH_RECT flag (must be smaller then whole image)
-		Rect RectRoi = Rect(cv::Point(0, 0), cv::Point(width, height)); 
-	
-		// Initialize mask
-		// creating complete mask as potential BG works only with the GC_INIT_WITH_RECT is used with the input mask (NOT GC_INIT_WITH_MASK)
-		// cv::Mat mask(img.size(), CV_8UC1, cv::Scalar(cv::GC_PR_BGD));	
-		cv::Mat mask(img.size(), CV_8UC1, cv::Scalar(cv::GC_BGD));	
-		
-		// get extension of the drawn lines
-		cv::Point minPoint(std::numeric_limits<int>::max(), std::numeric_limits<int>::max());
-		cv::Point maxPoint(std::numeric_limits<int>::min(), std::numeric_limits<int>::min());
-		int minXRad = 8, minYRad = 8, maxXRad = 8, maxYRad = 8;
-		for(const auto& pR : params.PnR) {
-			auto P = cv::Point(pR.pt.x, pR.pt.y);
-			if(P.x < minPoint.x) { minPoint.x = P.x; minXRad = pR.rad; }
-			if(P.y < minPoint.y) { minPoint.y = P.y; minYRad = pR.rad; }
-			if(P.x > maxPoint.x) { maxPoint.x = P.x; maxXRad = pR.rad; }
-			if(P.y > maxPoint.y) { maxPoint.y = P.y; maxYRad = pR.rad; }
+		// the session keeps the region around the scribbles, its mask and the color models between the evaluations
+		std::vector<Scribble> scribbles;
+		for(const auto& pR : params.PnR)
+			scribbles.push_back({ cv::Point(pR.pt.x, pR.pt.y), pR.rad, pR.foreground });
+		GrabCutSettings settings;
+		settings.margin = params.grabCutMargin;
+		settings.maxIterations = params.grabCutMaxIterations;
+		settings.convergence = params.grabCutConvergence;
+		settings.budgetMs = params.grabCutBudgetMs;
+		settings.coarseLevels = params.grabCutLevels;
+		settings.bandWidth = params.grabCutBand;
+
+		GrabCutSession& session = GrabCutSession::Instance();
+		Rect region;
+		Mat foreground;
+		GrabCutSession::Stats stats;
+		bool report = true;
+		if(params.grabCutAsync) {
+			// the previous result stays on display until the restarted run published its first iteration
+			if(params.grabCutRestart)
+				session.RunAsync(img.getMat(ACCESS_READ), scribbles, settings);
+			const GrabCutSession::Result result = session.TakeResult();
+			region = result.region;
+			foreground = result.foreground;
+			stats = result.stats;
+			report = result.done;
+		} else {
+			session.Cancel();
+			session.Wait();
+			region = session.Run(img.getMat(ACCESS_READ), scribbles, settings);
+			session.ForegroundMask(foreground);
+			stats = session.LastRun();
 		}
-		
-		// using bounding rect around drawn points 
-		RectRoi = { minPoint.x - minXRad , minPoint.y - minYRad, 
-			(maxPoint.x + maxXRad)-(minPoint.x - minXRad), (maxPoint.y + maxYRad) - (minPoint.y-minYRad)};
- 
-		keepRectInBounds(RectRoi, width, height);
-		cv::Mat mask_inner(RectRoi.size(), CV_8UC1, cv::Scalar(cv::GC_PR_BGD));
-		mask_inner.copyTo(mask(RectRoi)); 
-
-		// add all the stroked pixels to the corresponding value in the mask
-		int countFG = 0; 
-		for(const auto& pR : params.PnR) {
-			uchar value; 
-			if(pR.foreground) { 
-				value = cv::GC_FGD; 
-				countFG++;
+		if(report)
+			std::cout << "grabcut " << (stats.resumed ? "resumed" : stats.coarseToFine ? "started coarse to fine" : "started") << " (" << region.width << " x " << region.height << "): "
+				<< stats.iterations << " iterations, " << stats.changed * 100 << "% changed in the last, " << stats.ms << " ms ";
+
+		if(!region.empty()) {
+			// 25.1.24 DS: GrabCut is not implemented with UMat as of opencv 4.6.0 (asserts type=Mat for the input parameters)
+			const Vec3b col = ClassColor(LabelState::Instance().GetActiveClass());
+			{
+				const Mat image = img.getMat(ACCESS_READ);
+				Mat out = target(region);
+				BlendMaskRGBA(image(region), foreground, Vec3b(col[2], col[1], col[0]), params.alpha_display, out);
 			}
-			else value = cv::GC_BGD;
-
-			auto P = cv::Point(pR.pt.x, pR.pt.y); 
-			cv::circle(mask, P, pR.rad, cv::Scalar(value), cv::FILLED); 
-		}
-		std::cout << " FG:" << countFG <<  " CV points added \n";
-		// make sure User does not do shit - at least one FG point must exist (not only BG)
-		if(countFG == 0) {
-			cv::circle(mask, cv::Point(RectRoi.x+RectRoi.width/2, RectRoi.y+RectRoi.height/2), 10, cv::Scalar(cv::GC_FGD), cv::FILLED);
+			// save the classPixelMask (where mask is Forground)  to the temporary mask 
+			foreground.copyTo(tempMask(region));
 		}
-
-		// Create foreground and background models
-		cv::Mat bgdModel, fgdModel; 
-		//UMat imgRoi = img(RectRoi).clone();
-		cv::Mat result = img.getMat(ACCESS_RW).clone();
-		//Note: iterCount (1) Number of iterations the algorithm should make before returning the result. Result can be refined with further calls with mode==GC_INIT_WITH_MASK or mode==GC_EVAL 
-		//cv::grabCut(img, mask, RectRoi, bgdModel, fgdModel, 1, cv::GC_INIT_WITH_RECT); // input rect works with RectRoi
-		cv::grabCut(result, mask, RectRoi, bgdModel, fgdModel, 1, cv::GC_INIT_WITH_MASK ); // combining flags does not work as Documentation says!!
-
-
-		Vec3b col = colors2.at(LabelState::Instance().GetActiveClass());
-		Scalar colorBGR = Scalar(col[2], col[1], col[0]);
-
-		// Blend images by Iterate over each pixel - CPU Time: ~303ms 
-		//for(int y = 0; y < img.rows; y++) {
-		//	for(int x = 0; x < img.cols; x++) {
-		//		// Check if the current mask pixel matches the condition
-		//		if(mask.at<uchar>(y, x) == cv::GC_PR_FGD || mask.at<uchar>(y, x) == cv::GC_FGD) {
-		//			// Blend the highlight color with the original pixel
-		//			cv::Vec3b& pixel = result.at<cv::Vec3b>(y, x);
-		//			for(int c = 0; c < 3; c++) {
-		//				pixel[c] = (pixel[c] + col[c]) / 2;
-		//			}
-		//		}
-		//	}
-		//}	
-		
-		// DS: this could be used 
-		// cv::Mat result(img.size(), CV_8UC3, cv::Scalar(0, 0, 0));
-		// img.copyTo(result, (mask == cv::GC_PR_FGD) | (mask == cv::GC_FGD)); // needs probable FG as results (FG seems to be only the input)	
-	
-		//UMat classRegion = result.clone().getUMat(ACCESS_FAST); 		 ;
-
-		Mat classRegion = result.clone(); 	
-		Mat mask_FG = (mask == cv::GC_PR_FGD) | (mask == cv::GC_FGD); 
-		classRegion.setTo(colorBGR, mask_FG);
-		addWeighted( classRegion, params.alpha_display, result,    //CPU Time ~105ms
-					(1.0 - params.alpha_display), 0.0, result);
-
-		// save the classPixelMask (where mask is Forground)  to the temporary mask 
-		//mask_FG.copyTo(tempMask(RectRoi), mask_FG);
-		mask_FG.copyTo(tempMask);
-
-		UMat imgToDisplay = result.getUMat(ACCESS_FAST);
-		cv::cvtColor(imgToDisplay, image_rgba, cv::COLOR_BGR2RGBA);
-
+		renderRGBA(img, region, UMat(), target);
+		changed = region;
 	} 
 	else if((op & DisplayClass) == DisplayClass) {
 		bool completeImage = false;
 		if(completeImage) {
 			// A) Display of the resulting mask incl. alpha in the class color over the whole image
-			UMat imgToDisplay = img.clone();  // imgToDisplay because else the original image is changed
+			UMat imgToDisplay = copyOfImage("display");  // imgToDisplay because else the original image is changed
 
 			// get color and region for class 
-			Vec3b col = colors2.at(LabelState::Instance().GetActiveClass());
+			Vec3b col = ClassColor(LabelState::Instance().GetActiveClass());
 			Scalar color = Scalar(col[2], col[1], col[0]);
 			UMat classPixelMask = LabelState::Instance().GetActiveClassRegion();
 
-			UMat classRegion = img.clone();
+			UMat classRegion = copyOfImage("classRegion");
 			classRegion.setTo(color, classPixelMask);			
 			addWeighted(imgToDisplay, params.alpha_display, classRegion,
 						(1.0 - params.alpha_display), 0.0, imgToDisplay);
@@ -723,103 +860,75 @@ cv::UMat ApplyCVOperation(ImageProcParameters params, float* color, CvOperation
 			color *= params.alpha_display;
 			imgToDisplay.setTo(color, LabelState::GetActiveClassRegion());*/
 
-			cv::cvtColor(imgToDisplay, image_rgba, cv::COLOR_BGR2RGBA);
+			cv::cvtColor(imgToDisplay, target, cv::COLOR_BGR2RGBA);
+			fullFrameCopies++;
+			changed = Rect(0, 0, img.cols, img.rows);
 
 		} else {
 			// B) use a bounding box arround the mask to get the max extension - only faster if area is way smaller
 			// than the whole image - maybe because of the found Zero-Points (e.g. 364718 ) 
-			UMat imgToDisplay = img.clone();
-			UMat Points;
-			UMat classPixelMask = LabelState::Instance().GetActiveClassRegion();
-			findNonZero(classPixelMask, Points);
-			Rect Min_Rect = boundingRect(Points);
-			if(Points.empty())  Min_Rect = { 0, 0, img.cols, img.rows }; 
+			// the bounding box is maintained with the class statistics - no need to search the pixels,
+			// the mask is only built inside of it
+			Rect Min_Rect = LabelState::Instance().GetClassStats(LabelState::Instance().GetActiveClass()).bbox;
+			if(Min_Rect.empty())  Min_Rect = { 0, 0, img.cols, img.rows }; 
+			UMat classPixelMask = LabelState::Instance().GetActiveClassRegion(Min_Rect);
 
 			// obtain the image ROI:
 			UMat imgRoi = img(Min_Rect).clone();
 			// get color and region for class 
-			Vec3b col = colors2.at(LabelState::Instance().GetActiveClass());
+			Vec3b col = ClassColor(LabelState::Instance().GetActiveClass());
 			Scalar colorBGR = Scalar(col[2], col[1], col[0]);
 
 			UMat classRegion = imgRoi.clone();
 			// set all pixels of the classRegion image ROI to the color of the class
-			classRegion.setTo(colorBGR, classPixelMask(Min_Rect));
+			classRegion.setTo(colorBGR, classPixelMask);
 			// in the ROI blend the original image and the one with the pixel mask 
 			addWeighted(classRegion, params.alpha_display, imgRoi,
 						(1.0 - params.alpha_display), 0.0, imgRoi);
 
-			imgRoi.copyTo(imgToDisplay(Min_Rect));
-			cv::cvtColor(imgToDisplay, image_rgba, cv::COLOR_BGR2RGBA);
+			renderRGBA(img, Min_Rect, imgRoi, target);
+			changed = Min_Rect;
 		}
 	} 
 	else if((op & DisplayAllClasses) == DisplayAllClasses) {
 
-		UMat imgToDisplay = img.clone();
-		int num_classes = LabelState::Instance().MasksSize() - 1;
-		UMat classImg = UMat::zeros(LabelState::Instance().h(), LabelState::Instance().w(), CV_8UC3);
-		Rect minRect;
-
-		for(int i = num_classes; i >= 0; i--) {
-
-			UMat region = LabelState::Instance().GetClassRegion(i);
-			if(region.empty() || countNonZero(region) == 0) continue; // skip empty or complete black class
-
-			Vec3b classColor = colors2.at(i);
-			Scalar newVal = Scalar(classColor[2], classColor[1], classColor[0]);
-			UMat col_region = UMat::zeros(LabelState::Instance().h(), LabelState::Instance().w(), CV_8UC3);
-			col_region.setTo(newVal, region);
-			// TODO: try optimizing - save topmost and bottom right point for using minRect
-			//UMat Points;
-			//findNonZero(region, Points);
-			
-			//classImg |= col_region; // not for UMat
-			cv::bitwise_or(classImg, col_region, classImg);
-		}
-		bool speed_optim = false;
-		if(speed_optim) { 
-			// TODO: find fast solution - maybe calculate the bounding rect from the for loop above
-			UMat region;
-			threshold(classImg, region, 0, 255, THRESH_BINARY);
-			UMat Points;
-			findNonZero(region, Points); // check if faster  
-			Rect minRect = boundingRect(classImg);
-			if(minRect.empty() || minRect.area() == 0) {
-				minRect = { 0, 0, img.cols, img.rows };
-			}
-			UMat blend = imgToDisplay(minRect).clone();
-
-			// set all pixels of the classRegion image ROI to the color of the class
-			classImg(minRect).copyTo(blend);
-
-			//blend.setTo(color, classPixelMask(Min_Rect));
-			// in the ROI blend the original image and the one with the pixel mask 
-			addWeighted(blend, params.alpha_display, classImg,
-						(1.0 - params.alpha_display), 0.0, blend);
- 
-			blend.copyTo(imgToDisplay(minRect));
-
-			//TESTING
-			//imgToDisplay = classImg | (imgToDisplay & ~classImg);
-			//classImg.copyTo(imgToDisplay); 
+		// the class colors are a separate layer drawn over the image (ClassOverlay) - here only the image is needed
+		if(params.overlayLayer) {
+			cv::cvtColor(img, target, cv::COLOR_BGR2RGBA);
 		} else {
- 
-			// this makes the original image darker, the lower the alpha value is
-			addWeighted(classImg, params.alpha_display, imgToDisplay,
-						(1.0 - params.alpha_display), 0.0, imgToDisplay); // around 120ms
+			// without the layer: the CPU reference of the draw time blending
+			const Mat& overlay = ClassOverlay::Instance().Update(LabelState::Instance().GetCurrentState());
+			CompositeLayers(img.getMat(ACCESS_READ), overlay, params.alpha_display, target);
 		}
-
-		cv::cvtColor(imgToDisplay, image_rgba, cv::COLOR_BGR2RGBA);
+		// the whole frame is written - the tiles of the last composite differ otherwise
+		changed = Rect(0, 0, img.cols, img.rows);
+		fullFrameCopies++;
 		std::cout << "display all classes ";
 	}
 	else if ( (op & Clear) == Clear) { // e.g. op == Clear for reseting displayed image
-	 
-		UMat imgToDisplay = img.clone();
-		cv::cvtColor(imgToDisplay, image_rgba, cv::COLOR_BGR2RGBA);
+		cv::cvtColor(img, target, cv::COLOR_BGR2RGBA);
+		changed = Rect(0, 0, img.cols, img.rows);
+		fullFrameCopies++;
 	}
 	
 
-    //cv::cvtColor(imgToDisplay, image_rgba, cv::COLOR_BGR2RGBA);
 	// Note: no need to Stop() the timer here, as the object gets destroyed at the end of the function
+	const BufferPool::Counters poolAfter = pool.Totals();
+	std::cout << "(buffers: " << poolAfter.allocations - poolBefore.allocations << " allocated in " << poolAfter.allocationMs - poolBefore.allocationMs
+		<< " ms, " << poolAfter.reuses - poolBefore.reuses << " reused, " << fullFrameCopies << " full frame copies) ";
+	return true;
+}
+
+/// The result as RGBA image (one more copy than rendering into the target directly)
+cv::UMat ApplyCVOperation(ImageProcParameters params, float* color, CvOperation op) {
+	cv::UMat img = LabelState::Instance().GetCurrentImg();
+	if(img.empty()) img = CreateDefaultTextImg("There is no image here. Probably it was removed!?").getUMat(ACCESS_RW);
+	Mat rgba = BufferPool::Instance().GetMat("rgba", img.size(), CV_8UC4);
+	Rect changed;
+	ApplyCVOperation(params, color, op, rgba, changed);
+	UMat image_rgba;
+	rgba.copyTo(image_rgba);
+	fullFrameCopies++;
 	return image_rgba;
 }
 
@@ -827,7 +936,7 @@ cv::UMat ApplyCVOperation(ImageProcParameters params, float* color, CvOperation
 int addMaskToClassregion(bool overwriteOtherClasses, bool setCompleteMask, bool multiplePixelLabels) {
 	// for watershed etc. set the complete resulting class masks
 	if(setCompleteMask) {
-		return LabelState::Instance().setSegmentationMasks(tempMask, true);
+		return LabelState::Instance().setSegmentationMasks(tempLabels, true, tempMaskRoi);
 	}
 	// add the active class mask to the labels
 	else
@@ -26,6 +26,7 @@
 #include "imgcodecs.hpp"
 #include "core/directx.hpp"
 #include <vector>
+#include <cmath>
 #include "helper.h"
 #include <iostream> //todo: remove
 
@@ -52,6 +53,9 @@ enum CvOperation {
 };
 
 enum Shape { RectangleD = 0, PolygonD = 1, CircleD = 2, BrushD = 3, MarkerPointsD=4, CutsD = 5, ArcD = 15, };
+// where the marker watershed runs: the whole image, the bounding box of the markers (plus a margin) or on a 
+// downscaled image first and then only in a band around the boundaries at full resolution
+enum WatershedMode { WatershedFull = 0, WatershedMarkersRoi = 1, WatershedCoarseToFine = 2 };
 
 static std::vector<cv::Vec3b> colors2 = {
 	cv::Vec3b(53, 56, 57),     // Onyx(background)
@@ -96,15 +100,38 @@ static std::vector<cv::Vec3b> colors2 = {
 
 };
 
+// Color (RGB) of any class number: the predefined colors first, then generated ones - the hue advances by the
+// golden angle so neighbouring classes get clearly different colors, saturation and value vary as well
+static cv::Vec3b ClassColor(int index)
+{
+	if(index >= 0 && index < colors2.size())
+		return colors2.at(index);
+
+	const float h = std::fmod(index * 137.508f, 360.0f) / 60.0f;
+	const float s = 0.55f + 0.45f * ((index * 7) % 5) / 4.0f;
+	const float v = 0.70f + 0.30f * ((index * 3) % 4) / 3.0f;
+	const float c = v * s;
+	const float x = c * (1.0f - std::fabs(std::fmod(h, 2.0f) - 1.0f));
+	float r = 0, g = 0, b = 0;
+	switch(static_cast<int>(h)) {
+		case 0: r = c; g = x; break;
+		case 1: r = x; g = c; break;
+		case 2: g = c; b = x; break;
+		case 3: g = x; b = c; break;
+		case 4: r = x; b = c; break;
+		default: r = c; b = x; break;
+	}
+	const float m = v - c;
+	return cv::Vec3b(cv::saturate_cast<uchar>((r + m) * 255), cv::saturate_cast<uchar>((g + m) * 255), cv::saturate_cast<uchar>((b + m) * 255));
+}
+
 static std::vector<int> getColor(int index)
 {
 	std::vector<int> Color = { 0,0,0 };
 	if (index == 0) return Color;  
 
-	if (colors2.size() > index) {
-		auto col = colors2.at(index);
-		Color = { col[0], col[1], col[2] }; 
-	}
+	auto col = ClassColor(index);
+	Color = { col[0], col[1], col[2] }; 
 	return Color; 
 }
 
@@ -277,6 +304,19 @@ struct ImageProcParameters {
 	FF ff; 
 	RGBrange colorThresholds;
 	bool drawAllClasses; 
+	bool overlayLayer = true; // the class colors are drawn as a separate layer over the image (else blended on the CPU)
+	bool fusedThreshold = true; // rectangle threshold preview in one pass (FusedThreshold.h)
+	int watershedMode = WatershedFull;
+	int watershedMargin = 64; // pixels around the markers (WatershedMarkersRoi)
+	int watershedLevels = 2;  // pyramid levels of the coarse run (WatershedCoarseToFine)
+	int grabCutMargin = 32;   // GrabCutSettings
+	int grabCutMaxIterations = 5;
+	float grabCutConvergence = 0.001f;
+	int grabCutBudgetMs = 500;
+	int grabCutLevels = 0;    // coarse to fine (0: full resolution)
+	int grabCutBand = 6;
+	bool grabCutAsync = false;   // on the worker thread, the overlay shows each iteration
+	bool grabCutRestart = false; // the scribbles changed (else only the latest result of the background run is shown)
 	cv::Point m_point; 
 
 	void setHSV(float h, float s, float v, int h_tol, int s_tol, int v_tol,
@@ -378,7 +418,7 @@ struct ImageProcParameters {
 		m_point = cv::Point(mousePosition.x, mousePosition.y);
 	}
     void replaceClass(int classNr) { 
-			pixelClassToReplace = classNr < 30 ? classNr : 0;
+			pixelClassToReplace = classNr >= 0 ? classNr : 0;
 	}
 
 };
@@ -0,0 +1,122 @@
+/*
+ * This file is part of PixLabelCV.
+ *
+ * Copyright (C) 2024 Dominik Schraml
+ *
+ * PixLabelCV is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Alternatively, commercial licenses are available. Please contact SQB Ilmenau
+ * at olaf.glaessner@sqb-ilmenau.de or dominik.schraml@sqb-ilmenau.de for more details.
+ *
+ * PixLabelCV is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PixLabelCV. If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include "LabelMap.h"
+
+using namespace cv;
+
+
+LabelMap LabelMap::FromMat(const cv::Mat& labels) {
+	CV_Assert(labels.type() == CV_8UC1 || labels.type() == CV_16UC1);
+	LabelMap map(labels.rows, labels.cols);
+	parallel_for_(Range(0, map.tileCount()), [&](const Range& range) {
+		for(int t = range.start; t < range.end; t++) {
+			Mat tileLabels = labels(map.tileRect(t));
+			if(countNonZero(tileLabels) > 0) {
+				Mat tile;
+				tileLabels.convertTo(tile, CV_16U);
+				map.setTile(t, std::make_shared<const Mat>(tile));
+			}
+		}
+	});
+	return map;
+}
+
+void LabelMap::ToMat(cv::Mat& labels, int type) const {
+	labels.create(rows, cols, type);
+	parallel_for_(Range(0, tileCount()), [&](const Range& range) {
+		for(int t = range.start; t < range.end; t++) {
+			Mat dst = labels(tileRect(t));
+			if(tile(t))
+				tile(t)->convertTo(dst, type); // dst has the right size and type - written in place
+			else
+				dst.setTo(0);
+		}
+	});
+}
+
+cv::Mat LabelMap::ToMat() const {
+	Mat labels;
+	ToMat(labels);
+	return labels;
+}
+
+void LabelMap::ClassMask(int classNumber, cv::Mat& mask) const {
+	ClassMask(classNumber, mask, Rect(0, 0, cols, rows));
+}
+
+void LabelMap::ClassMask(int classNumber, cv::Mat& mask, cv::Rect roi) const {
+	roi &= Rect(0, 0, cols, rows);
+	mask.create(roi.size(), CV_8U);
+	const std::vector<int> touched = tilesIn(roi);
+	parallel_for_(Range(0, static_cast<int>(touched.size())), [&](const Range& range) {
+		for(int i = range.start; i < range.end; i++) {
+			const int t = touched[i];
+			const Rect rect = tileRect(t);
+			const Rect part = rect & roi;
+			Mat dst = mask(part - roi.tl());
+			if(tile(t))
+				compare((*tile(t))(part - rect.tl()), Scalar(classNumber), dst, CMP_EQ);
+			else
+				dst.setTo(classNumber == 0 ? 255 : 0);
+		}
+	});
+}
+
+void LabelMap::SetClass(int classNumber, const cv::Mat& mask) {
+	CV_Assert(mask.rows == rows && mask.cols == cols);
+	parallel_for_(Range(0, tileCount()), [&](const Range& range) {
+		for(int t = range.start; t < range.end; t++) {
+			Mat tileMask = mask(tileRect(t));
+			if(countNonZero(tileMask) == 0) continue; // stays shared
+			if(!tile(t) && classNumber == 0) continue;
+			Mat labels = CopyOfTile(t);
+			labels.setTo(classNumber, tileMask);
+			setTile(t, std::make_shared<const Mat>(labels));
+		}
+	});
+}
+
+void LabelMap::SetRegion(const cv::Mat& labels, cv::Rect roi) {
+	CV_Assert(labels.size() == roi.size() && (roi & Rect(0, 0, cols, rows)) == roi);
+	const std::vector<int> touched = tilesIn(roi);
+	parallel_for_(Range(0, static_cast<int>(touched.size())), [&](const Range& range) {
+		for(int i = range.start; i < range.end; i++) {
+			const int t = touched[i];
+			const Rect rect = tileRect(t);
+			const Rect part = rect & roi;
+			Mat src;
+			labels(part - roi.tl()).convertTo(src, CV_16U);
+			const bool same = tile(t) ? countNonZero(src != (*tile(t))(part - rect.tl())) == 0 : countNonZero(src) == 0;
+			if(same) continue; // stays shared
+			Mat copy = CopyOfTile(t);
+			src.copyTo(copy(part - rect.tl()));
+			setTile(t, countNonZero(copy) > 0 ? std::make_shared<const Mat>(copy) : nullptr);
+		}
+	});
+}
+
+cv::Mat LabelMap::CopyOfTile(int t) const {
+	if(tile(t))
+		return tile(t)->clone();
+	return Mat::zeros(tileRect(t).size(), CV_16U);
+}
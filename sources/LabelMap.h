@@ -0,0 +1,49 @@
+/*
+ * This file is part of PixLabelCV.
+ *
+ * Copyright (C) 2024 Dominik Schraml
+ *
+ * PixLabelCV is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Alternatively, commercial licenses are available. Please contact SQB Ilmenau
+ * at olaf.glaessner@sqb-ilmenau.de or dominik.schraml@sqb-ilmenau.de for more details.
+ *
+ * PixLabelCV is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PixLabelCV. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include "TileGrid.h"
+
+// Class number of every pixel (single label mode) stored in CV_16U tiles, so the number of classes does not 
+// change the memory or the time of any operation. Tiles that contain only background (0) are not allocated.
+class LabelMap : public TileGrid<cv::Mat>
+{
+public:
+	LabelMap() {}
+	LabelMap(int rows, int cols) : TileGrid(rows, cols) {} // all background
+
+	static LabelMap FromMat(const cv::Mat& labels); // CV_8U or CV_16U
+	void ToMat(cv::Mat& labels, int type = CV_16U) const;
+	cv::Mat ToMat() const;
+
+	// binary 0/255 mask of the pixels labeled as classNumber - class 0 is every unlabeled pixel (the former 
+	// background mask held only the background set explicitly)
+	void ClassMask(int classNumber, cv::Mat& mask) const;
+	void ClassMask(int classNumber, cv::Mat& mask, cv::Rect roi) const; // mask has the size of roi
+	// labels all pixels of the mask (!= 0) as classNumber - only the touched tiles are copied
+	void SetClass(int classNumber, const cv::Mat& mask);
+	// the labels (CV_8U or CV_16U, size of roi) replace the region - only the tiles that change are copied
+	void SetRegion(const cv::Mat& labels, cv::Rect roi);
+
+	// a copy of the tile that may be changed - all zero if the tile is not allocated
+	cv::Mat CopyOfTile(int t) const;
+};
@@ -22,6 +22,9 @@
 
 #pragma once
 #include "LabelState.h"
+#include "MaskIO.h"
+#include "BufferPool.h"
+#include "GrabCutSession.h"
 #include "opencv2/imgproc.hpp"
 #include "opencv2/core.hpp"
 #include "Timer.h"
@@ -29,6 +32,8 @@
 #include "opencv2/core.hpp" 
 #include "opencv2/imgcodecs.hpp"  
 #include <filesystem>
+#include <atomic>
+#include <map>
 using namespace cv;
 namespace fs = std::filesystem;
 
@@ -38,34 +43,21 @@ int LabelState::tryloadmask(std::string mask_path) {
 		return -1;
 	}
 
-	UMat mask = imread(mask_path, IMREAD_GRAYSCALE).getUMat(cv::ACCESS_READ);
+	// 8 or 16 bit gray or palette indexed PNG
+	Mat mask = ReadLabelImage(mask_path);
 
 	if(mask.empty())
 		return -2;
 
-	// check that img has only one channel - else take the first channel
-	if(mask.channels() > 1)
-		extractChannel(mask, mask, 0);
-
-	double max, min;
-	minMaxIdx(mask, &min, &max);
-	int max_class = static_cast<int>(max);
-	//minMaxLoc(mask, &min, &max_class, &dummy, &maxLoc); 
-	//UMat m_empty = UMat::zeros(height, width, CV_8U);
-	//auto ffa = new std::vector<UMat>(static_cast<int>(max_class), m_empty);
+	// one histogram pass and one pass that writes the label map or all class planes
+	MaskState loaded;
+	int decoded = DecodeLabelImage(mask, multipleLabels, loaded);
+	if(decoded != 0)
+		return decoded;
 
 	// clear the masks
 	ClearState();
-
-	std::vector<UMat> labelM;
-	for(int i = max_class; i >= 0; i--) { // from high to low just for fun
-		cv::UMat classI;
-		//threshold(mask, classI, i, 255, CV_8U); // = mask;
-		inRange(mask, i, i, classI);
-
-		labelM.insert(labelM.begin(), classI);
-	}
-	pushState(labelM);
+	pushState(loaded);
 	//delete ffa;  
 // }
 	return 0;
@@ -75,50 +67,51 @@ int LabelState::tryloadmask(std::string mask_path) {
 // Tries to load seperate files (checks if the folders and img-file exist first)
 int LabelState::tryLoadSeperateMasks(std::string mask_folder, std::string mask_name_postfix) {
 
-	const int max_classes = 30;
-	std::vector<UMat> temp_Mask;
-
-	for(int i = 0; i < max_classes; ++i) {
-		std::string subfolderName = mask_folder + "/" + std::to_string(i);
-		// search in subfolder for each class
-		if(fs::exists(subfolderName) && fs::is_directory(subfolderName)) {
-			std::string maskFileName = mask_name_postfix;
-
-			for(const auto& entry : fs::directory_iterator(subfolderName)) {
-				if(entry.is_regular_file()) {
-					auto filename = entry.path().filename().string();
-					// Check for the mask with the right name
-					if(fs::exists(filename) &&
-					   (filename == maskFileName + ".png" ||
-					   filename == maskFileName + std::to_string(i) + ".png")) {
-
-						Mat classMask = cv::imread(entry.path().string(), IMREAD_GRAYSCALE);
-						// load it into the temporary label first
-						temp_Mask.push_back(classMask.clone().getUMat(ACCESS_FAST));
-					}
-				}
-			}
-
-		}
+	// every numeric subfolder is a class - no fixed upper limit, missing classes stay empty
+	std::map<int, Mat> classMasks;
+	for(const auto& [classNr, file] : FindSeparateMasks(mask_folder, mask_name_postfix)) {
+		Mat classMask = cv::imread(file, IMREAD_GRAYSCALE);
+		if(!classMask.empty() && classMask.size() == cv::Size(width, height))
+			classMasks[classNr] = classMask;
 	}
 
-	if(temp_Mask.size() == 0)
+	MaskState loaded;
+	if(classMasks.empty())
 		// if no mask could be loaded create a dummy one
-		for(int i = 0; i < 3; i++)
-			temp_Mask.push_back(cv::UMat::zeros(height, width, CV_8U));
-
-	pushState(temp_Mask);
+		loaded = CreateEmptyState(3);
+	else {
+		loaded = CreateEmptyState(classMasks.rbegin()->first + 1);
+		if(!multipleLabels) {
+			// combine the binary masks into the label map - higher classes have higher priority
+			for(const auto& [classNr, classMask] : classMasks)
+				if(classNr > 0) loaded.labelMap.SetClass(classNr, classMask);
+		} else {
+			for(const auto& [classNr, classMask] : classMasks)
+				if(countNonZero(classMask) > 0) loaded.classPlanes[classNr] = BitPlane::FromMask(classMask);
+		}
+	}
 
-	//Mat DGB_loadedMask = temp_Mask[0].getMat(ACCESS_READ);
-	return 0;
+	// the masks of another image must not be part of the undo history
+	ClearState();
+	pushState(loaded);
+	return static_cast<int>(classMasks.size());
 }
 
 
 cv::Mat LabelState::load_new_image(std::string img_path, const std::string mask_path, bool load_mask) {
 
+	currentImg.release();
+	imageBytes.Set(0);
+	BufferPool::Instance().Clear(); // the temporaries of the last image have the wrong size
+	GrabCutSession::Instance().Reset();
 	Mat Copy = cv::imread(img_path);
+	// the image copy and a label map of the same size - makes room by evicting history and caches.
+	// The image is loaded anyway (there is nothing to label without it), the UI warns about the shortfall.
+	if(!MemoryTracker::Instance().Reserve(int64_t(Copy.total()) * (Copy.elemSize() + sizeof(ushort))))
+		std::cerr << "loading " << img_path << " exceeds the memory budget\n";
 	//currentImg = cv::imread(img_path).getUMat(cv::ACCESS_FAST);
 	currentImg = Copy.clone().getUMat(cv::ACCESS_FAST);
+	imageBytes.Set(int64_t(currentImg.total()) * currentImg.elemSize());
 	//Mat DBG_Img = currentImg.getMat(cv::ACCESS_READ);
 
 	if(!currentImg.empty()) {
@@ -136,11 +129,7 @@ cv::Mat LabelState::load_new_image(std::string img_path, const std::string mask_
 			// DS: 7.2.24 switched to clear Masks
 			// labeledMasks().clear(); 
 			ClearState();
-			std::vector<UMat> temp_Mask;
-			for(int i = 0; i < 3; i++) //start with 3 as default
-				//labeledMasks().push_back(cv::UMat::zeros(height, width, CV_8U));
-				temp_Mask.push_back(cv::UMat::zeros(height, width, CV_8U));
-			pushState(temp_Mask);
+			pushState(CreateEmptyState(3)); //start with 3 as default
 		}
 	}
 	return Copy;
@@ -151,70 +140,40 @@ cv::Mat LabelState::load_new_image(std::string img_path, const std::string mask_
 // it has to be checked before that the directory to save in does exist!
 int LabelState::saveLabels(const std::string singleMaskPath, bool seperateImages) {
 
-	if(labeledMasks().size() == 0) return -2;
+	// a consistent version for the whole save - independent of later edits
+	const std::shared_ptr<const MaskSnapshot> snapshot = Snapshot();
+	const MaskState& state = snapshot->state;
+	if(state.empty()) return -2;
 
 	// 11.2.24 DS: save seperate mask files 
 	if(seperateImages == true) {
-		try {
-			UMat backgroundMask = UMat::ones(height, width, CV_8U); // TODO: check if Mat would be faster than UMat
-
-			for(int i = 1; i <= labeledMasks().size() - 1; i++) {
-				cv::UMat classI = labeledMasks()[i];
-
-				// Check if the mask contains any value greater than 0
-				if(cv::countNonZero(labeledMasks()[i]) > 0) {
-					fs::path maskClassFolder = fs::path(singleMaskPath).parent_path() / std::to_string(i);
-					fs::create_directories(maskClassFolder);
-
-					// Prepare the mask for saving: Ensure it's 8-bit binary image
-					cv::Mat binaryMask;
-					labeledMasks()[i].convertTo(binaryMask, CV_8U);
-					// cv::threshold(binaryMask, binaryMask, 0, 255, cv::THRESH_BINARY);// works - but should also work without
-
-					// Construct the filename
-					fs::path filePath = fs::path(maskClassFolder) / (fs::path(singleMaskPath).stem().string() +
-																	 std::to_string(i) + ".png");
-
-					// Save the binary mask
-					cv::imwrite(filePath.string(), binaryMask);
-
-					//calculate Background as class 0 
-					bitwise_xor(backgroundMask, classI, backgroundMask);
-				}
+		// all class files and the background are encoded and written in parallel
+		std::vector<int> classes;
+		for(int i = 1; i < state.numClasses && i < state.stats.classes.size(); i++) {
+			// Check if the mask contains any value greater than 0
+			if(state.stats.classes[i].pixels > 0)
+				classes.push_back(i);
+		}
+		lastSaveReport = WriteSeparateMasks(state, classes, singleMaskPath);
+
+		bool failed = false;
+		for(const MaskFileResult& file : lastSaveReport) {
+			std::cout << " " << file.path << ": " << file.milliseconds << " ms";
+			if(!file.ok) {
+				std::cout << " FAILED (" << file.error << ")";
+				failed = true;
 			}
-			// Invert backgroundMask to get the final background mask (0 where any mask is non-zero)
-			cv::bitwise_not(backgroundMask, backgroundMask);
-
-			// Save the background mask
-			fs::path backgroundFolder = fs::path(singleMaskPath).parent_path() / "0";
-			fs::create_directories(backgroundFolder);
-			cv::imwrite((backgroundFolder / fs::path(singleMaskPath).stem()).string() + ".png", backgroundMask);
+			std::cout << "\n";
 		}
-		catch(std::exception& e) {
-			std::cout << e.what() << "\n";
+		if(failed)
 			return -1;
-		}
 	}
 	// create a mask with the class values from all the binary masks
 	// DS 2.8.23 switch so higher classes have highter priority! - Due to BUG: Adding to class 1 also inner region which was already labeled as class 2
 	else {
-		cv::UMat labelImg = cv::UMat::zeros(height, width, CV_8U);
-		for(int i = 1; i <= labeledMasks().size() - 1; i++) {
-			cv::UMat classI = labeledMasks()[i];
-
-			// Alt: get min and max vals of UMat
-			//double minVal, maxVal; 
-			//Point minLoc, maxLoc; 
-			//minMaxLoc(classI, &minVal, &maxVal, &minLoc, &maxLoc);		
-			//if (!classI.empty() && maxVal!=0.0) {
-			if(countNonZero(classI) != 0) {
-				UMat src = UMat::ones(height, width, CV_8U);
-				cv::multiply(src, Scalar(i), src); // *= i does not work for UMat
-				//bitwise_and( src, classI, labelImg);
-				//cv::copy(labelImg, src, classI);
-				labelImg.setTo(i, classI);
-			}
-		}
+		// one sweep over the tiles writes the final label image - the encoder gets it without further copies
+		cv::Mat labelImg;
+		ComposeLabelImage(state, DefaultClassPriority(state.numClasses), labelImg);
 
 		try {
 			std::string imgname = singleMaskPath;
@@ -223,14 +182,20 @@ int LabelState::saveLabels(const std::string singleMaskPath, bool seperateImages
 				imgname = singleMaskPath + ".png";
 			}
 			//imgname = "out.png";
-			bool result = cv::imwrite(imgname, labelImg);
-			auto a = result;
-
+			MaskFileResult result;
+			result.path = imgname;
+			result.ok = cv::imwrite(imgname, labelImg);
+			if(!result.ok) result.error = "could not be written";
+			lastSaveReport = { result };
+			if(!result.ok) {
+				std::cout << " " << imgname << " FAILED (" << result.error << ")\n";
+				return -1;
+			}
 		}
 		catch(std::exception& e) {
 			//show message box with error
+			std::cout << " " << singleMaskPath << " FAILED (" << e.what() << ")\n";
 			return -1;
-			//std::cout << e.what() << "\n";
 		}
 
 	}
@@ -238,15 +203,124 @@ int LabelState::saveLabels(const std::string singleMaskPath, bool seperateImages
 }
 
 
+void LabelState::pushState(const MaskState& newState) {
+	// find the tiles that are not shared with the previous state
+	std::vector<uchar> changed;
+	const MaskState& previous = GetCurrentState();
+	newState.labelMap.markChangedTiles(previous.labelMap, changed);
+	for(int i = 0; i < newState.classPlanes.size(); i++) {
+		if(i < previous.classPlanes.size())
+			newState.classPlanes[i].markChangedTiles(previous.classPlanes[i], changed);
+		else
+			newState.classPlanes[i].markChangedTiles(BitPlane(), changed);
+	}
+
+	MaskState state = newState;
+	state.dirtyTiles.clear();
+	for(int t = 0; t < changed.size(); t++)
+		if(changed[t]) state.dirtyTiles.push_back(t);
+	UpdateClassStats(state);
+
+	// the first state (after loading or switching the label mode) has no predecessor to undo to
+	if(!GetCurrentState().empty())
+		history.Push(GetCurrentState(), state);
+	publish(std::move(state));
+}
+
+
+void LabelState::publish(MaskState state) {
+	stateBytes.Set(state.bytes());
+	auto next = std::make_shared<const MaskSnapshot>(MaskSnapshot{ current->version + 1, std::move(state) });
+	std::atomic_store(&current, std::shared_ptr<const MaskSnapshot>(std::move(next)));
+}
+
+
+MaskState LabelState::CreateEmptyState(int numClasses) {
+	MaskState state;
+	state.numClasses = numClasses;
+	state.size = cv::Size(width, height);
+	if(!multipleLabels)
+		state.labelMap = LabelMap(height, width);
+	else
+		state.classPlanes.resize(numClasses); // empty planes - allocated on the first write
+	return state;
+}
+
+
+cv::UMat LabelState::GetActiveClassRegion(cv::Rect roi) {
+	// make sure that there are enough class masks - by adding empty ones if neccessary
+	ChangeActiveClass(activeClass);
+	return GetClassRegion(activeClass, roi);
+}
+
+
+cv::UMat LabelState::GetClassRegion(int class_number, cv::Rect roi) {
+	if(roi.empty()) roi = cv::Rect(0, 0, width, height);
+	const MaskState& state = GetCurrentState();
+	cv::Mat classMask;
+	if(multipleLabels && class_number < state.classPlanes.size() && !state.classPlanes.at(class_number).empty())
+		state.classPlanes.at(class_number).ToMask(classMask, roi);
+	else if(state.labelMap.empty() || class_number >= state.numClasses) // create the binary mask only when it is needed
+		classMask = cv::Mat::zeros(roi.size(), CV_8U);
+	else
+		state.labelMap.ClassMask(class_number, classMask, roi);
+	cv::UMat classRegion;
+	classMask.copyTo(classRegion);
+	return classRegion;
+}
+
+
+const ClassStats& LabelState::GetClassStats(int class_number) {
+	static const ClassStats noPixels;
+	const std::vector<ClassStats>& classes = GetCurrentState().stats.classes;
+	if(class_number < 0 || class_number >= classes.size())
+		return noPixels;
+	return classes[class_number];
+}
+
+
+void LabelState::SetMultipleLabels(bool allowed) {
+	if(allowed == multipleLabels) return;
+	multipleLabels = allowed;
+	if(GetCurrentState().empty()) return;
+
+	// convert the current state into the other representation - the older states are dropped 
+	MaskState oldState = CopyCurrentState();
+	MaskState converted = CreateEmptyState(oldState.numClasses);
+	if(allowed) {
+		for(int i = 0; i < oldState.numClasses; i++) {
+			if(oldState.stats.classes.size() <= i || oldState.stats.classes[i].pixels == 0) continue; // stays empty
+			cv::Mat classMask;
+			oldState.labelMap.ClassMask(i, classMask);
+			converted.classPlanes[i] = BitPlane::FromMask(classMask);
+		}
+	} else {
+		// higher classes have higher priority (like when saving the masks)
+		cv::Mat classMask;
+		for(int i = 1; i < oldState.numClasses && i < oldState.classPlanes.size(); i++) {
+			if(oldState.classPlanes[i].empty()) continue;
+			oldState.classPlanes[i].ToMask(classMask);
+			converted.labelMap.SetClass(i, classMask);
+		}
+	}
+	ClearState();
+	pushState(converted);
+}
+
+
 bool LabelState::ChangeActiveClass(int class_number) {
-	if(class_number < 0 || class_number > 19) return false;
+	if(class_number < 0 || class_number >= MAX_CLASSES) return false;
 	activeClass = class_number;
+	if(GetCurrentState().empty()) return true;
 	// add mask regions to the result, if there are not enough yet
-	if(labeledMasks().size() < static_cast<size_t>(class_number + 1) ) {
+	if(GetCurrentState().numClasses < class_number + 1) {
+		MaskState state = CopyCurrentState();
 		// class 0 is background so we need one more
-        while(labeledMasks().size() < static_cast<size_t>(class_number + 1)) {
-			labeledMasks().push_back(cv::UMat::zeros(height, width, CV_8U));
-		}
+		// the label map needs no memory for new classes and the new class planes stay empty until they are written
+		if(multipleLabels && state.classPlanes.size() < static_cast<size_t>(class_number + 1))
+			state.classPlanes.resize(class_number + 1);
+		state.numClasses = class_number + 1;
+		publish(std::move(state));
 	}
 	return true;
 }
@@ -260,63 +334,105 @@ int LabelState::addRegionToClass(cv::UMat newRegion, bool overwrite_existing, bo
 	}
 	if(newRegion.empty()) return -3;
 
+	// make sure the storage fits the labeling mode
+	SetMultipleLabels(multiplePixelLabelsAllowed);
+	ChangeActiveClass(activeClass);
+
 	// start timer
 	Timer timer1 = Timer();
 
 	// get a copy of the current labelMask
 	auto newState = CopyCurrentState();
-	bool state_changed= false; // to prevent pushing the same state twice
-
-	// Check for and do changes of all (other) class masks
-	for(int i = 0; i < newState.size(); i++) {
-		if(i == activeClass) continue; // skip comparison of currently active class for performance - as it is changed anyway
-
-		UMat classMask = newState.at(i);
-		UMat intersection;
-		cv::bitwise_and(classMask, newRegion, intersection);
-		// get non-zero pixels in the intersection of the current class region and the newRegion
-		int non_zeros = cv::countNonZero(intersection);
-
-		// only do somthing for class i if it's mask is different
-		if(non_zeros > 0) { 
-			// Background: remove this region from all other class masks - This has to be done even when multiple lables are allowed
-			if(activeClass == 0) {
-				UMat RegionToKeep; 
-				// region to keep is classMask minus intersection 
-				cv::bitwise_xor(classMask, intersection, RegionToKeep);
-				newState.at(i) = RegionToKeep; // |= would be wrong here				
-			}
-			// Remove the pixels that already belong to other classes from the new (active) region, so they are not added when only one label per pixel is allowed				
-			else if(multiplePixelLabelsAllowed == false &&
-					overwrite_existing == false &&
-					i != 0) { // current class is not background                
-				// result is newRegion without pixels already belonging to the i-th class, so changes are tracked below 
-				cv::bitwise_xor(newRegion, intersection, newRegion);
+	std::atomic<bool> state_changed(false); // to prevent pushing the same state twice
+
+	// all work is limited to the bounding rect of the region - only the tiles inside of it are touched 
+	cv::Mat region = newRegion.getMat(ACCESS_READ);
+	cv::Rect roi = cv::boundingRect(region);
+
+	// Single label: one pass over the label map decides the new label of every pixel in the region
+	// only the tiles with changed labels are copied - the others stay shared with the older states
+	if(!multipleLabels) {
+		LabelMap& labelMap = newState.labelMap;
+		std::vector<int> tiles = labelMap.tilesIn(roi);
+		const ushort active = static_cast<ushort>(activeClass);
+		cv::parallel_for_(cv::Range(0, static_cast<int>(tiles.size())), [&](const cv::Range& range) {
+			for(int k = range.start; k < range.end; k++) {
+				const int t = tiles[k];
+				cv::Rect tileRect = labelMap.tileRect(t);
+				cv::Rect rect = tileRect & roi;
+				const int offsetX = rect.x - tileRect.x, offsetY = rect.y - tileRect.y;
+				cv::Mat labels; // copied on the first change
+				for(int y = 0; y < rect.height; y++) {
+					const uchar* r = region.ptr<uchar>(rect.y + y) + rect.x;
+					const ushort* l = labelMap.tile(t) ? labelMap.tile(t)->ptr<ushort>(offsetY + y) + offsetX : nullptr;
+					for(int x = 0; x < rect.width; x++) {
+						ushort label = l ? l[x] : 0;
+						if(r[x] == 0 || label == active) continue;
+						// background resets every class, else only unlabeled pixels are taken if other classes must not be overwritten
+						if(activeClass == 0 || overwrite_existing || label == 0) {
+							if(labels.empty()) labels = labelMap.CopyOfTile(t);
+							labels.at<ushort>(offsetY + y, offsetX + x) = active;
+						}
+					}
+				}
+				if(!labels.empty()) {
+					labelMap.setTile(t, std::make_shared<const cv::Mat>(labels));
+					state_changed = true;
+				}
 			}
-			// remove the pixels that are overwritten by the active class from background or when overwriting classes
-			else if((multiplePixelLabelsAllowed == false &&
-					overwrite_existing == true) || i == 0) {
-				UMat RegionToKeep;
-				// region to keep is classMask minus intersection 
-				cv::bitwise_xor(classMask, intersection, RegionToKeep);
-				newState.at(i) = RegionToKeep;
+		});
+	} else {
+
+	// the region as bit plane (only inside the roi) - all class planes are changed with the fused tile kernels
+	BitPlane regionPlane = BitPlane::FromMask(region, roi);
+	std::vector<int> tiles = regionPlane.tilesIn(roi);
+	std::vector<BitPlane>& planes = newState.classPlanes;
+	// the active class plane is allocated on its first write
+	if(planes[activeClass].empty() && !tiles.empty())
+		planes[activeClass] = BitPlane(height, width);
+
+	// one pass per tile: intersect, count, remove from the other classes and add to the active class
+	cv::parallel_for_(cv::Range(0, static_cast<int>(tiles.size())), [&](const cv::Range& range) {
+		for(int k = range.start; k < range.end; k++) {
+			const int t = tiles[k];
+			const BitPlane::TilePtr& regionTile = regionPlane.tile(t);
+			if(!regionTile) continue;
+
+			for(int i = 0; i < planes.size(); i++) {
+				if(i == activeClass) continue; // the active class is changed anyway
+				// Background: remove this region from all other class masks - This has to be done even when multiple lables are allowed
+				// else only remove the pixels that are overwritten by the active class from background
+				if(activeClass != 0 && i != 0) continue;
+				if(planes[i].empty()) continue; // nothing to remove
+
+				const BitPlane::TilePtr& classTile = planes[i].tile(t);
+				if(!classTile) continue;
+				// region to keep is classMask minus intersection - only used if the intersection is not empty
+				auto regionToKeep = std::make_shared<BitTile>();
+				if(BitPlane::AndNotTile(*classTile, *regionTile, *regionToKeep) > 0) {
+					planes[i].setTile(t, regionToKeep);
+					state_changed = true;
+				}
 			}
-		} // changes in class mask i
-	} // for loop - all classes
 
-	// add resulting region to current class
-	//labeledMasks.at(activeClass) |= newRegion; // only for Mat 
-	UMat result;
-    cv::bitwise_or(newState.at(activeClass), newRegion, result);
-
-	// check for changes in the activeClass - this is valid for all cases (MAYBE except when background is active and no other class was touched) 
-	// norm inf calculats the max difference of each corresponding pixels of the Mats
-    double maxDiff = cv::norm(newState.at(activeClass), result, cv::NORM_INF); 
-	if (maxDiff > 0) state_changed = true; // if maxDiff is 0 the arrays are identical 
+			// add resulting region to current class - if the region has pixels that are not in the class yet 
+			const BitPlane::TilePtr& activeTile = planes[activeClass].tile(t);
+			if(!activeTile) {
+				planes[activeClass].setTile(t, regionTile);
+				state_changed = true;
+				continue;
+			}
+			auto result = std::make_shared<BitTile>();
+			if(BitPlane::OrTile(*activeTile, *regionTile, *result) > 0) {
+				planes[activeClass].setTile(t, result);
+				state_changed = true;
+			}
+		}
+	});
+	} // multiple labels
 
 	// only push a new state when it differs from the last one
     if (state_changed) {
-        newState.at(activeClass) = result;
 		pushState(newState);
 		std::cout << " add region to class " << activeClass << " took: ";
     } else {    
@@ -328,7 +444,7 @@ int LabelState::addRegionToClass(cv::UMat newRegion, bool overwrite_existing, bo
 
 
 // Is currently only used for watershed transform 
-int LabelState::setSegmentationMasks(cv::UMat classMasks, bool overwrite_existing) { // overwrite_existing is dummy for now - might be used later
+int LabelState::setSegmentationMasks(cv::UMat classMasks, bool overwrite_existing, cv::Rect roi) { // overwrite_existing is dummy for now - might be used later
 
 	if(classMasks.empty()) return -3;
 	// start timer
@@ -339,27 +455,48 @@ int LabelState::setSegmentationMasks(cv::UMat classMasks, bool overwrite_existin
 	double minValue, maxValue;
 	//cv::minMaxLoc(classMasks, nullptr, &maxValue); // does also work
 	cv::minMaxLoc(classMasks, &minValue, &maxValue, nullptr, nullptr);
-	uint8_t maxPixelValue = static_cast<uint8_t>(maxValue);
+	const int maxClass = static_cast<int>(maxValue); // CV_16U: up to MAX_CLASSES - 1
 
 	// get a copy of the current labelMask
 	// auto newState = CopyCurrentState(); // acutally we do not need to copy the state when the mask is applied to the complete image
-	auto newState = std::vector<UMat>(maxPixelValue);
-
-	// extend the class masks vector if to short - starting from class 0 (background)
-	while(newState.size() < maxPixelValue + 1) {
-		newState.push_back(cv::UMat::zeros(height, width, CV_8U));
+	MaskState newState;
+	newState.numClasses = std::max<int>(maxClass + 1, GetCurrentState().numClasses);
+	newState.size = classMasks.size();
+	// a result of a part of the image (e.g. watershed bounded to the markers) keeps the labels outside
+	const MaskState current = GetCurrentState();
+	const bool partial = !roi.empty() && roi != cv::Rect(0, 0, classMasks.cols, classMasks.rows)
+		&& current.size == classMasks.size() && !current.empty();
+
+	// the segmentation result is the label map already
+	if(!multipleLabels) {
+		if(partial) {
+			// the tiles outside of the roi (and unchanged ones) stay shared - only those are dirty
+			newState.labelMap = current.labelMap.empty() ? LabelMap(newState.size.height, newState.size.width) : current.labelMap;
+			newState.labelMap.SetRegion(classMasks(roi).getMat(ACCESS_READ), roi);
+		} else
+			newState.labelMap = LabelMap::FromMat(classMasks.getMat(ACCESS_READ));
+		pushState(newState);
+		timer1.Stop();
+		return 0;
 	}
 
-	// Iterate over each unique class index (= pixel Value)
-	for(int i = 0; i <= maxPixelValue; i++) {
-		// Threshold the image to obtain pixels with the target value
-		cv::UMat thresholdedImage;
-
-		// use opencv's compare function to get the mask for the target class
-		cv::compare(classMasks, Scalar(i), thresholdedImage, cv::CMP_EQ);
-
-		// Assign the mask to the vector
-		newState.at(i) = thresholdedImage;
+	// one pass over the result writes the planes of all classes (instead of a compare per class)
+	const int numClasses = newState.numClasses;
+	DecodeLabelImage(classMasks.getMat(ACCESS_READ), true, newState);
+	newState.numClasses = numClasses;
+	newState.classPlanes.resize(numClasses); // classes that are not in the result stay empty
+	if(partial) {
+		cv::Mat roiMask = cv::Mat::zeros(newState.size, CV_8U);
+		roiMask(roi).setTo(255);
+		const BitPlane roiPlane = BitPlane::FromMask(roiMask);
+		for(int c = 0; c < numClasses; c++) {
+			BitPlane inside = newState.classPlanes[c].empty() ? BitPlane() : BitPlane::And(newState.classPlanes[c], roiPlane);
+			const bool kept = c < current.classPlanes.size() && !current.classPlanes[c].empty();
+			BitPlane outside = kept ? BitPlane::AndNot(current.classPlanes[c], roiPlane) : BitPlane();
+			if(inside.empty()) newState.classPlanes[c] = outside;
+			else if(outside.empty()) newState.classPlanes[c] = inside;
+			else newState.classPlanes[c] = BitPlane::Or(outside, inside);
+		}
 	}
 	pushState(newState);
 	timer1.Stop();
@@ -367,14 +504,39 @@ int LabelState::setSegmentationMasks(cv::UMat classMasks, bool overwrite_existin
 	return 0;
 }
 
+int LabelState::RemapClasses(const std::vector<int>& lut) {
+	if(GetCurrentState().empty()) return -1;
+	std::cout << "relabel classes: ";
+	Timer timer;
+	MaskState remapped = CopyCurrentState();
+	::RemapClasses(remapped, lut);
+	pushState(remapped); // one undo step
+	return 0;
+}
+
+
 bool LabelState::Undo() {
 
-	if(currentIndex == -1) {
+	MaskState state = CopyCurrentState();
+	if(!history.Undo(state)) {
 		std::cerr << "No history available for undo." << std::endl;
 		return false;
 	}
-	// just switch index of the state array
-	currentIndex = (currentIndex - 1 + capacity) % capacity;
-	std::cout << "index = " << currentIndex << "\n";
+	UpdateClassStats(state);
+	publish(std::move(state));
+	std::cout << "undo - steps left: " << history.UndoSteps() << "\n";
 	return true;
 }
+
+bool LabelState::Redo() {
+
+	MaskState state = CopyCurrentState();
+	if(!history.Redo(state)) {
+		std::cerr << "Nothing to redo." << std::endl;
+		return false;
+	}
+	UpdateClassStats(state);
+	publish(std::move(state));
+	std::cout << "redo - steps left: " << history.RedoSteps() << "\n";
+	return true;
+}
\ No newline at end of file
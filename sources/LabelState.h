@@ -23,7 +23,14 @@
 #pragma once
 #include "opencv2/core.hpp" 
 #include "opencv2/imgcodecs.hpp"
+#include "MaskHistory.h"
+#include "MaskIO.h"
+#include "MemoryTracker.h"
 #include <filesystem>
+#include <memory>
+#include <atomic>
+
+
 
 
 class LabelState
@@ -31,7 +38,6 @@ class LabelState
 public:
 	static LabelState& Instance() {
 		static LabelState instance; // Guaranteed to be destroyed. Instantiated on first use.
-		instance.buffer_masks.resize(capacity); // initialize the vector with the correct size
 		return instance;
 	}
 
@@ -44,50 +50,49 @@ public:
 	//void load_new_image(std::string img_path, const std::string mask_path, bool load_mask);
 	cv::Mat load_new_image(std::string img_path, const std::string mask_path = "/mask", bool load_mask = false);
 	int saveLabels(const std::string labelPath, bool seperateImages);
+	// time and result of every file written by the last save of seperate masks
+	const std::vector<MaskFileResult>& LastSaveReport() { return lastSaveReport; }
 	cv::UMat GetCurrentImg() {
 		return currentImg;
 	}
 	int GetActiveClass() {
 		return activeClass;
 	}
-	cv::UMat GetActiveClassRegion() {
-		// make sure that there are enough class masks - by adding empty ones if neccessary
-		if(labeledMasks().size() < activeClass + 1) {
-			for(int i = labeledMasks().size(); i <= activeClass; i++) //start with 3 as default
-				labeledMasks().push_back(cv::UMat::zeros(height, width, CV_8U));
-		}
-		return labeledMasks().at(activeClass);
-	}
-	cv::UMat GetClassRegion(int class_number) {
-		return labeledMasks().at(class_number);
-	}
+	cv::UMat GetActiveClassRegion(cv::Rect roi = cv::Rect());
+	// binary mask of the class - created on demand from the label map in single label mode
+	// roi: only this part of the image (empty: the whole image)
+	cv::UMat GetClassRegion(int class_number, cv::Rect roi = cv::Rect());
+	// pixel count and bounding box of the class - maintained incrementally with every edit
+	const ClassStats& GetClassStats(int class_number);
 	bool ChangeActiveClass(int class_number);
 	int addRegionToClass(cv::UMat newRegion, bool overwriteExisting, bool multiplePixelLabels);
-	int setSegmentationMasks(cv::UMat classMasks, bool overwrite_existing);
-	int MasksSize() { return labeledMasks().size(); };
+	// roi: only this region of classMasks replaces the labels (empty: the whole image)
+	int setSegmentationMasks(cv::UMat classMasks, bool overwrite_existing, cv::Rect roi = cv::Rect());
+	// relabels the classes of the whole image with the lookup table (see ClassRemapTable) - one pass, one undo step
+	int RemapClasses(const std::vector<int>& lut);
+	int MasksSize() { return GetCurrentState().numClasses; };
 	int h() { return height; }
 	int w() { return width; }
 
+	// switch between the label map (one label per pixel) and the binary masks per class 
+	void SetMultipleLabels(bool allowed);
+	bool MultipleLabels() { return multipleLabels; }
+
 	// mask state
-	void pushState(const std::vector<cv::UMat>& newLabeledMask) {
-		currentIndex = (currentIndex + 1) % capacity;
-		buffer_masks[currentIndex] = newLabeledMask;
-	}
+	void pushState(const MaskState& newState);
 	bool Undo();
-	int GetCurrentIndex() { return currentIndex; }
-	// get a reference to the current Masks (= the active state)
-	inline std::vector<cv::UMat>& labeledMasks() {
-		//return buffer_masks.at(currentIndex);
-		//if(currentIndex <= -1) return  ; // can not give back nullptr here
-		return buffer_masks.at(currentIndex);
-	}
-
-	const std::vector<cv::UMat>& GetCurrentState() {
-		if(currentIndex == -1) {
-			return {};
-		}
-		return buffer_masks.at(currentIndex);
-	}
+	bool Redo();
+	// only valid until the next change - the UI thread (the only writer) may use it directly, other threads use Snapshot()
+	const MaskState& GetCurrentState() { return current->state; }
+	// the current version - cheap (one reference count), it stays valid and unchanged as long as it is held
+	std::shared_ptr<const MaskSnapshot> Snapshot() const { return std::atomic_load(&current); }
+	uint64_t Version() const { return Snapshot()->version; }
+	// the undo history stores compressed deltas - its memory is limited by the budget
+	MaskHistory& History() { return history; }
+	// tiles (of TILE_SIZE) changed by the last edit - the regions that have to be updated (display, saving, ...)
+	const std::vector<int>& DirtyTiles() { return GetCurrentState().dirtyTiles; }
+	cv::Rect TileRect(int tile) { return cv::Rect((tile % tilesX()) * TILE_SIZE, (tile / tilesX()) * TILE_SIZE, TILE_SIZE, TILE_SIZE) & cv::Rect(0, 0, width, height); }
+	int tilesX() { return (width + TILE_SIZE - 1) / TILE_SIZE; }
 	
 	void CreateUsageImg();
 	bool FillRegion;
@@ -97,7 +102,10 @@ public:
 	bool drawingFinished = false;
 
 private:
-	LabelState() {}                       // (the {} brackets) are needed here.
+	LabelState() : current(std::make_shared<const MaskSnapshot>()) {
+		// the undo history is the first thing to go when the memory budget is exceeded
+		MemoryTracker::Instance().AddEvictor(MemoryOwner::History, [this](int64_t bytes) { return history.Evict(bytes); });
+	}
 	// C++ 03
 	// ========
 	// Don't forget to declare these two. You want to make sure they
@@ -110,20 +118,24 @@ private:
 	int activeClass = 0;
 	int width;
 	int height;
+	bool multipleLabels = false;
 
-	static const int capacity = 2;
-	std::vector<std::vector<cv::UMat>> buffer_masks;
-	int currentIndex;
+	// the published version - replaced as a whole (atomically) with every change, empty until an image is loaded
+	std::shared_ptr<const MaskSnapshot> current;
+	TrackedBytes imageBytes{ MemoryOwner::Image };
+	TrackedBytes stateBytes{ MemoryOwner::ClassPlanes }; // tiles of the current state
+	MaskHistory history;
+	std::vector<MaskFileResult> lastSaveReport;
 
-	std::vector<cv::UMat> CopyCurrentState() {
-		const std::vector<cv::UMat>& currentState = GetCurrentState(); // Copy the current state into a new vector
-		return currentState;
+	// makes the state the new current version
+	void publish(MaskState state);
+	MaskState CopyCurrentState() {
+		return GetCurrentState(); // Copy the current state (the label map is cloned before it is changed)
 	}
-	void ClearState() { // clear the complete state - used after loading
-		for(auto& state : buffer_masks) {
-			state.clear();
-		}
-		currentIndex = -1;
+	MaskState CreateEmptyState(int numClasses);
+	void ClearState() { // clear the complete state and its history - used after loading
+		publish(MaskState());
+		history.Clear();
 	};
 };
  
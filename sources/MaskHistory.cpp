@@ -0,0 +1,268 @@
+/*
+ * This file is part of PixLabelCV.
+ *
+ * Copyright (C) 2024 Dominik Schraml
+ *
+ * PixLabelCV is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Alternatively, commercial licenses are available. Please contact SQB Ilmenau
+ * at olaf.glaessner@sqb-ilmenau.de or dominik.schraml@sqb-ilmenau.de for more details.
+ *
+ * PixLabelCV is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PixLabelCV. If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include "MaskHistory.h"
+#include "opencv2/imgproc.hpp"
+#include <algorithm>
+
+using namespace cv;
+
+// the bytes of a tile as CV_8U Mat header - empty if the tile is not allocated
+static Mat asBytes(const Mat& tile) {
+	return Mat(tile.rows, tile.cols * static_cast<int>(tile.elemSize()), CV_8U, tile.data, tile.step);
+}
+
+static Mat tileBytes(const LabelMap& map, int t) {
+	return map.tile(t) ? asBytes(*map.tile(t)) : Mat();
+}
+
+static Mat tileBytes(const BitPlane& plane, int t) {
+	if(plane.empty() || !plane.tile(t)) return Mat();
+	return Mat(TILE_SIZE, BIT_TILE_STEP, CV_8U, const_cast<uchar*>(plane.tile(t)->bits));
+}
+
+// (run length, value) pairs of the bytes in row major order
+static void encodeRLE(const Mat& bytes, std::vector<uchar>& rle) {
+	int run = 0;
+	uchar value = 0;
+	for(int y = 0; y < bytes.rows; y++) {
+		const uchar* row = bytes.ptr<uchar>(y);
+		for(int x = 0; x < bytes.cols; x++) {
+			if(run > 0 && (row[x] != value || run == 255)) {
+				rle.push_back(static_cast<uchar>(run));
+				rle.push_back(value);
+				run = 0;
+			}
+			value = row[x];
+			run++;
+		}
+	}
+	if(run > 0) {
+		rle.push_back(static_cast<uchar>(run));
+		rle.push_back(value);
+	}
+}
+
+// xor the decoded bytes into the bytes (which have the size of the delta's rect)
+static void xorRLE(const std::vector<uchar>& rle, Mat bytes) {
+	const int width = bytes.cols;
+	int i = 0;
+	for(size_t k = 0; k + 1 < rle.size(); k += 2) {
+		int run = rle[k];
+		uchar value = rle[k + 1];
+		if(value == 0) {
+			i += run;
+			continue;
+		}
+		for(; run > 0; run--, i++)
+			bytes.at<uchar>(i / width, i % width) ^= value;
+	}
+}
+
+static void addDelta(std::vector<TileDelta>& deltas, int plane, int t, const Mat& before, const Mat& after) {
+	if(before.data == after.data) return; // shared (or both empty) - unchanged
+	Mat diff;
+	if(before.empty())
+		diff = after;
+	else if(after.empty())
+		diff = before;
+	else
+		bitwise_xor(before, after, diff);
+
+	Rect rect = boundingRect(diff);
+	if(rect.empty()) return;
+	TileDelta delta;
+	delta.plane = plane;
+	delta.tile = t;
+	delta.rect = rect;
+	encodeRLE(diff(rect), delta.rle);
+	deltas.push_back(std::move(delta));
+}
+
+
+void MaskHistory::Push(const MaskState& before, const MaskState& after) {
+	auto step = std::make_shared<HistoryStep>();
+	step->numClassesBefore = before.numClasses;
+	step->numClassesAfter = after.numClasses;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		// a new edit drops the steps that could be redone
+		for(size_t i = position; i < steps.size(); i++)
+			totalBytes -= steps[i]->bytes;
+		steps.erase(steps.begin() + position, steps.end());
+		steps.push_back(step);
+		position = steps.size();
+		trackedBytes.Set(totalBytes);
+	}
+	// the states only share their tiles - so keeping them until the delta is done is cheap
+	step->done = worker.Submit([this, step, before, after] { Compress(*step, before, after); }).share();
+}
+
+void MaskHistory::Compress(HistoryStep& step, const MaskState& before, const MaskState& after) {
+	std::vector<TileDelta> deltas;
+	static const BitPlane noPlane;
+	for(int t : after.dirtyTiles) {
+		if(!after.labelMap.empty())
+			addDelta(deltas, -1, t, tileBytes(before.labelMap, t), tileBytes(after.labelMap, t));
+		for(int i = 0; i < after.classPlanes.size(); i++) {
+			Mat previous = i < before.classPlanes.size() ? tileBytes(before.classPlanes[i], t) : Mat();
+			addDelta(deltas, i, t, previous, tileBytes(after.classPlanes[i], t));
+		}
+	}
+
+	size_t bytes = sizeof(HistoryStep);
+	for(const TileDelta& delta : deltas)
+		bytes += sizeof(TileDelta) + delta.rle.capacity();
+
+	std::lock_guard<std::mutex> lock(mutex);
+	step.deltas = std::move(deltas);
+	step.bytes = bytes;
+	step.compressed = true;
+	totalBytes += bytes;
+	EnforceBudget();
+}
+
+void MaskHistory::EnforceBudget() {
+	dropSteps(budget);
+}
+
+void MaskHistory::dropSteps(size_t limit) {
+	// drop the oldest steps first
+	while(totalBytes > limit && position > 0 && steps.front()->compressed) {
+		totalBytes -= steps.front()->bytes;
+		steps.pop_front();
+		position--;
+	}
+	// only steps that could be redone are left
+	while(totalBytes > limit && position < steps.size() && steps.back()->compressed) {
+		totalBytes -= steps.back()->bytes;
+		steps.pop_back();
+	}
+	trackedBytes.Set(totalBytes);
+}
+
+int64_t MaskHistory::Evict(int64_t bytes) {
+	std::lock_guard<std::mutex> lock(mutex);
+	const size_t before = totalBytes;
+	dropSteps(totalBytes > static_cast<size_t>(bytes) ? totalBytes - bytes : 0);
+	return before - totalBytes;
+}
+
+void MaskHistory::Apply(const HistoryStep& step, MaskState& state) {
+	state.dirtyTiles.clear();
+	for(const TileDelta& delta : step.deltas) {
+		if(delta.plane < 0) {
+			Mat labels = state.labelMap.CopyOfTile(delta.tile);
+			xorRLE(delta.rle, asBytes(labels)(delta.rect));
+			state.labelMap.setTile(delta.tile, countNonZero(labels) > 0 ? std::make_shared<const Mat>(labels) : nullptr);
+		} else {
+			if(state.classPlanes.size() <= static_cast<size_t>(delta.plane))
+				state.classPlanes.resize(delta.plane + 1);
+			BitPlane& plane = state.classPlanes[delta.plane];
+			if(plane.empty()) // allocated on the first write
+				plane = BitPlane(state.size.height, state.size.width);
+			auto tile = std::make_shared<BitTile>();
+			Mat bits(TILE_SIZE, BIT_TILE_STEP, CV_8U, tile->bits);
+			if(plane.tile(delta.tile))
+				tileBytes(plane, delta.tile).copyTo(bits);
+			else
+				bits.setTo(0);
+			xorRLE(delta.rle, bits(delta.rect));
+			plane.setTile(delta.tile, countNonZero(bits) > 0 ? tile : nullptr);
+		}
+		state.dirtyTiles.push_back(delta.tile);
+	}
+	std::sort(state.dirtyTiles.begin(), state.dirtyTiles.end());
+	state.dirtyTiles.erase(std::unique(state.dirtyTiles.begin(), state.dirtyTiles.end()), state.dirtyTiles.end());
+}
+
+// the planes follow the number of classes (multi label mode) - a class added by the step is gone after its undo
+static void setNumClasses(MaskState& state, int numClasses) {
+	state.numClasses = numClasses;
+	if(state.labelMap.empty())
+		state.classPlanes.resize(numClasses);
+}
+
+bool MaskHistory::Undo(MaskState& state) {
+	std::shared_ptr<HistoryStep> step;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if(position == 0) return false;
+		step = steps[position - 1];
+	}
+	step->done.wait(); // only waits if the delta is still being compressed
+
+	std::lock_guard<std::mutex> lock(mutex);
+	if(position == 0 || steps[position - 1] != step) return false; // dropped in the meantime
+	Apply(*step, state);
+	setNumClasses(state, step->numClassesBefore);
+	position--;
+	return true;
+}
+
+bool MaskHistory::Redo(MaskState& state) {
+	std::lock_guard<std::mutex> lock(mutex);
+	if(position >= steps.size()) return false;
+	// steps that can be redone were undone before - so they are compressed already
+	Apply(*steps[position], state);
+	setNumClasses(state, steps[position]->numClassesAfter);
+	position++;
+	return true;
+}
+
+void MaskHistory::Clear() {
+	worker.Wait();
+	std::lock_guard<std::mutex> lock(mutex);
+	steps.clear();
+	position = 0;
+	totalBytes = 0;
+	trackedBytes.Set(0);
+}
+
+void MaskHistory::SetBudget(size_t bytes) {
+	std::lock_guard<std::mutex> lock(mutex);
+	budget = bytes;
+	EnforceBudget();
+}
+
+size_t MaskHistory::Bytes() {
+	std::lock_guard<std::mutex> lock(mutex);
+	return totalBytes;
+}
+
+std::vector<size_t> MaskHistory::DeltaSizes() {
+	std::lock_guard<std::mutex> lock(mutex);
+	std::vector<size_t> sizes;
+	for(const auto& step : steps)
+		sizes.push_back(step->bytes);
+	return sizes;
+}
+
+int MaskHistory::UndoSteps() {
+	std::lock_guard<std::mutex> lock(mutex);
+	return static_cast<int>(position);
+}
+
+int MaskHistory::RedoSteps() {
+	std::lock_guard<std::mutex> lock(mutex);
+	return static_cast<int>(steps.size() - position);
+}
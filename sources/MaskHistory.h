@@ -0,0 +1,83 @@
+/*
+ * This file is part of PixLabelCV.
+ *
+ * Copyright (C) 2024 Dominik Schraml
+ *
+ * PixLabelCV is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Alternatively, commercial licenses are available. Please contact SQB Ilmenau
+ * at olaf.glaessner@sqb-ilmenau.de or dominik.schraml@sqb-ilmenau.de for more details.
+ *
+ * PixLabelCV is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PixLabelCV. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include "MaskState.h"
+#include "ThreadPool.h"
+#include "MemoryTracker.h"
+#include <deque>
+
+// XOR difference of one tile of one class plane (or the label map), limited to the bounding rect of the changed bytes.
+// XOR makes the delta its own inverse: applying it to the newer state gives the older one and vice versa.
+struct TileDelta {
+	int plane = -1;         // -1: label map, else the class number
+	int tile = 0;
+	cv::Rect rect;          // in bytes of the tile (a bit tile row has BIT_TILE_STEP bytes)
+	std::vector<uchar> rle; // (run length, value) pairs of the xor bytes inside rect
+};
+
+// one edit - compressed on the history's worker thread
+struct HistoryStep {
+	std::vector<TileDelta> deltas;
+	int numClassesBefore = 0;
+	int numClassesAfter = 0;
+	size_t bytes = 0;
+	bool compressed = false;
+	std::shared_future<void> done;
+};
+
+// Undo/redo history of the mask states stored as compressed deltas.
+// The oldest steps are dropped when the history needs more memory than the budget.
+class MaskHistory
+{
+public:
+	MaskHistory() : worker(1) {}
+
+	// records the step from before to after (after.dirtyTiles must be set) - the delta is created in the background
+	void Push(const MaskState& before, const MaskState& after);
+	// change the state to the one before / after the current step
+	bool Undo(MaskState& state);
+	bool Redo(MaskState& state);
+	void Clear();
+
+	void SetBudget(size_t bytes);
+	size_t Budget() { return budget; }
+	size_t Bytes();                  // memory of all compressed steps
+	int64_t Evict(int64_t bytes);    // drops the oldest steps to free the bytes (memory budget) - returns the freed bytes
+	std::vector<size_t> DeltaSizes(); // bytes per step from oldest to newest
+	int UndoSteps();
+	int RedoSteps();
+
+private:
+	void Compress(HistoryStep& step, const MaskState& before, const MaskState& after);
+	void Apply(const HistoryStep& step, MaskState& state);
+	void EnforceBudget(); // expects the mutex to be locked
+	void dropSteps(size_t limit); // until the steps need at most limit bytes - expects the mutex to be locked
+
+	std::deque<std::shared_ptr<HistoryStep>> steps; // steps before position can be undone, the rest redone
+	size_t position = 0;
+	size_t totalBytes = 0;
+	size_t budget = 64 * 1024 * 1024;
+	std::mutex mutex;
+	TrackedBytes trackedBytes{ MemoryOwner::History };
+	ThreadPool worker;
+};
@@ -0,0 +1,563 @@
+/*
+ * This file is part of PixLabelCV.
+ *
+ * Copyright (C) 2024 Dominik Schraml
+ *
+ * PixLabelCV is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Alternatively, commercial licenses are available. Please contact SQB Ilmenau
+ * at olaf.glaessner@sqb-ilmenau.de or dominik.schraml@sqb-ilmenau.de for more details.
+ *
+ * PixLabelCV is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PixLabelCV. If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include "MaskIO.h"
+#include "Timer.h"
+#include "ThreadPool.h"
+#include "opencv2/imgproc.hpp"
+#include "opencv2/imgcodecs.hpp"
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <unordered_map>
+
+using namespace cv;
+namespace fs = std::filesystem;
+
+static uint32_t readBigEndian(const uchar* bytes) {
+	return (uint32_t(bytes[0]) << 24) | (uint32_t(bytes[1]) << 16) | (uint32_t(bytes[2]) << 8) | bytes[3];
+}
+
+// the palette (as BGR) of an indexed PNG (color type 3) - empty for every other image
+static std::vector<Vec3b> readPngPalette(const std::string& path) {
+	std::vector<Vec3b> palette;
+	std::ifstream file(path, std::ios::binary);
+	static const uchar pngSignature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	uchar signature[8];
+	if(!file.read(reinterpret_cast<char*>(signature), 8) || std::memcmp(signature, pngSignature, 8) != 0)
+		return palette;
+
+	uchar header[8];
+	while(file.read(reinterpret_cast<char*>(header), 8)) {
+		const uint32_t length = readBigEndian(header);
+		const std::string type(reinterpret_cast<char*>(header + 4), 4);
+		if(type == "IDAT" || type == "IEND") break; // the palette has to be before the image data
+
+		std::vector<uchar> data(length);
+		if(!file.read(reinterpret_cast<char*>(data.data()), length)) break;
+		file.seekg(4, std::ios::cur); // crc
+
+		if(type == "IHDR" && (length < 10 || data[9] != 3)) break; // not indexed
+		if(type == "PLTE") {
+			for(uint32_t i = 0; i + 2 < length; i += 3)
+				palette.push_back(Vec3b(data[i + 2], data[i + 1], data[i]));
+			break;
+		}
+	}
+	return palette;
+}
+
+cv::Mat ReadLabelImage(const std::string& path) {
+	std::vector<Vec3b> palette = readPngPalette(path);
+	if(!palette.empty()) {
+		// OpenCV expands the palette - map the colors back to their index (the first one if a color is used twice)
+		Mat color = imread(path, IMREAD_COLOR);
+		if(color.empty()) return Mat();
+		std::unordered_map<uint32_t, uchar> indexOf;
+		for(int i = static_cast<int>(palette.size()) - 1; i >= 0; i--)
+			indexOf[(palette[i][0] << 16) | (palette[i][1] << 8) | palette[i][2]] = static_cast<uchar>(i);
+
+		Mat labels(color.size(), CV_8U);
+		parallel_for_(Range(0, color.rows), [&](const Range& range) {
+			for(int y = range.start; y < range.end; y++) {
+				const Vec3b* src = color.ptr<Vec3b>(y);
+				uchar* dst = labels.ptr<uchar>(y);
+				for(int x = 0; x < color.cols; x++) {
+					auto it = indexOf.find((src[x][0] << 16) | (src[x][1] << 8) | src[x][2]);
+					dst[x] = it != indexOf.end() ? it->second : 0;
+				}
+			}
+		});
+		return labels;
+	}
+
+	Mat labels = imread(path, IMREAD_UNCHANGED | IMREAD_ANYDEPTH);
+	if(labels.empty()) return labels;
+	// color masks are read as gray image like before
+	if(labels.channels() == 2) // gray + alpha
+		extractChannel(labels, labels, 0);
+	else if(labels.channels() == 3)
+		cvtColor(labels, labels, COLOR_BGR2GRAY);
+	else if(labels.channels() == 4)
+		cvtColor(labels, labels, COLOR_BGRA2GRAY);
+	if(labels.depth() != CV_8U && labels.depth() != CV_16U)
+		return Mat();
+	return labels;
+}
+
+
+template<typename T>
+static int decodeLabels(const Mat& labels, bool multipleLabels, MaskState& state) {
+	// 1. histogram pass - which classes are present
+	const int bins = 1 << (8 * sizeof(T));
+	std::vector<int64_t> histogram(bins, 0);
+	std::mutex histogramMutex;
+	parallel_for_(Range(0, labels.rows), [&](const Range& range) {
+		std::vector<int64_t> local(bins, 0);
+		for(int y = range.start; y < range.end; y++) {
+			const T* row = labels.ptr<T>(y);
+			for(int x = 0; x < labels.cols; x++)
+				local[row[x]]++;
+		}
+		std::lock_guard<std::mutex> lock(histogramMutex);
+		for(int i = 0; i < bins; i++)
+			histogram[i] += local[i];
+	}, getNumThreads()); // one stripe (and local histogram) per thread
+	int maxClass = 0;
+	for(int i = 0; i < bins; i++)
+		if(histogram[i] > 0) maxClass = i;
+	state.numClasses = maxClass + 1;
+	state.size = labels.size();
+
+	// 2. one pass over the tiles that writes the label map or all class planes
+	if(!multipleLabels) {
+		state.labelMap = LabelMap(labels.rows, labels.cols);
+		LabelMap& map = state.labelMap;
+		parallel_for_(Range(0, map.tileCount()), [&](const Range& range) {
+			for(int t = range.start; t < range.end; t++) {
+				Rect rect = map.tileRect(t);
+				Mat tileLabels(rect.size(), CV_16U);
+				bool labeled = false;
+				for(int y = 0; y < rect.height; y++) {
+					const T* src = labels.ptr<T>(rect.y + y) + rect.x;
+					ushort* dst = tileLabels.ptr<ushort>(y);
+					for(int x = 0; x < rect.width; x++) {
+						dst[x] = src[x];
+						labeled |= src[x] != 0;
+					}
+				}
+				if(labeled) map.setTile(t, std::make_shared<const Mat>(tileLabels));
+			}
+		});
+	} else {
+		// only the classes that are present get a plane
+		state.classPlanes.resize(state.numClasses);
+		std::vector<BitPlane>& planes = state.classPlanes;
+		for(int i = 0; i < state.numClasses; i++)
+			if(histogram[i] > 0) planes[i] = BitPlane(labels.rows, labels.cols);
+		const TileGrid<BitTile> grid(labels.rows, labels.cols);
+		parallel_for_(Range(0, grid.tileCount()), [&](const Range& range) {
+			std::vector<std::shared_ptr<BitTile>> tiles(planes.size());
+			std::vector<int> present; // classes of the current tile
+			for(int t = range.start; t < range.end; t++) {
+				Rect rect = grid.tileRect(t);
+				for(int y = 0; y < rect.height; y++) {
+					const T* src = labels.ptr<T>(rect.y + y) + rect.x;
+					for(int x = 0; x < rect.width; x++) {
+						auto& tile = tiles[src[x]];
+						if(!tile) { // first pixel of the class in this tile
+							tile = std::make_shared<BitTile>();
+							std::memset(tile->bits, 0, sizeof(tile->bits));
+							present.push_back(src[x]);
+						}
+						tile->bits[y * BIT_TILE_STEP + (x >> 3)] |= 1 << (x & 7);
+					}
+				}
+				for(int c : present) {
+					planes[c].setTile(t, tiles[c]);
+					tiles[c] = nullptr;
+				}
+				present.clear();
+			}
+		});
+	}
+	return 0;
+}
+
+int DecodeLabelImage(const cv::Mat& labels, bool multipleLabels, MaskState& state) {
+	CV_Assert(labels.channels() == 1);
+	if(labels.depth() == CV_16U)
+		return decodeLabels<ushort>(labels, multipleLabels, state);
+	return decodeLabels<uchar>(labels, multipleLabels, state);
+}
+
+
+std::vector<int> DefaultClassPriority(int numClasses) {
+	std::vector<int> priority;
+	for(int i = 1; i < numClasses; i++)
+		priority.push_back(i);
+	return priority;
+}
+
+// value into the pixels of the bit tile that are set - row pointers, empty and full bytes handled at once
+template<typename T>
+static void writeBitTile(const uchar* bits, Size size, T value, Mat& dst) {
+	for(int y = 0; y < size.height; y++) {
+		const uchar* src = bits + y * BIT_TILE_STEP;
+		T* row = dst.ptr<T>(y);
+		for(int b = 0; b * 8 < size.width; b++) {
+			const uchar byte = src[b];
+			if(byte == 0) continue;
+			T* px = row + b * 8;
+			if(byte == 0xFF && b * 8 + 8 <= size.width) {
+				std::fill(px, px + 8, value);
+				continue;
+			}
+			for(int j = 0; j < 8; j++) // bits beyond the image are zero
+				if((byte >> j) & 1) px[j] = value;
+		}
+	}
+}
+
+void ComposeLabelImage(const MaskState& state, const std::vector<int>& priority, cv::Mat& labels) {
+	// 8 bit PNGs as long as the classes fit - 16 bit only for more classes
+	const int type = state.numClasses <= 256 ? CV_8U : CV_16U;
+	if(!state.labelMap.empty()) {
+		// one label per pixel - the label map is the result
+		state.labelMap.ToMat(labels, type);
+		return;
+	}
+	const TileGrid<BitTile> grid(state.size.height, state.size.width);
+	labels.create(state.size, type);
+	parallel_for_(Range(0, grid.tileCount()), [&](const Range& range) {
+		for(int t = range.start; t < range.end; t++) {
+			Rect rect = grid.tileRect(t);
+			Mat dst = labels(rect);
+			dst.setTo(0);
+			// the tile stays in the cache while the classes are written in priority order
+			for(int c : priority) {
+				if(c <= 0 || c >= state.classPlanes.size() || state.classPlanes[c].empty() || !state.classPlanes[c].tile(t)) continue;
+				const uchar* bits = state.classPlanes[c].tile(t)->bits;
+				if(type == CV_8U)
+					writeBitTile(bits, rect.size(), static_cast<uchar>(c), dst);
+				else
+					writeBitTile(bits, rect.size(), static_cast<ushort>(c), dst);
+			}
+		}
+	});
+}
+
+
+void BackgroundMask(const MaskState& state, cv::Mat& mask) {
+	if(!state.labelMap.empty()) {
+		state.labelMap.ClassMask(0, mask);
+		return;
+	}
+	const TileGrid<BitTile> grid(state.size.height, state.size.width);
+	mask.create(state.size, CV_8U);
+	parallel_for_(Range(0, grid.tileCount()), [&](const Range& range) {
+		BitTile labeled;
+		for(int t = range.start; t < range.end; t++) {
+			Rect rect = grid.tileRect(t);
+			// union of all classes in this tile
+			std::memset(labeled.bits, 0, sizeof(labeled.bits));
+			for(size_t c = 1; c < state.classPlanes.size(); c++) {
+				if(state.classPlanes[c].empty()) continue;
+				const BitPlane::TilePtr& tile = state.classPlanes[c].tile(t);
+				if(!tile) continue;
+				for(int i = 0; i < sizeof(labeled.bits); i++)
+					labeled.bits[i] |= tile->bits[i];
+			}
+			for(int y = 0; y < rect.height; y++) {
+				const uchar* src = labeled.bits + y * BIT_TILE_STEP;
+				uchar* dst = mask.ptr<uchar>(rect.y + y) + rect.x;
+				for(int x = 0; x < rect.width; x++)
+					dst[x] = (src[x >> 3] >> (x & 7)) & 1 ? 0 : 255;
+			}
+		}
+	});
+}
+
+// creates the mask, the folder and writes the file - exceptions are reported in the result
+template<typename CreateMask>
+static MaskFileResult writeMaskFile(const fs::path& filePath, CreateMask createMask) {
+	MaskFileResult result;
+	result.path = filePath.string();
+	auto start = std::chrono::high_resolution_clock::now();
+	try {
+		Mat mask;
+		createMask(mask);
+		fs::create_directories(filePath.parent_path());
+		result.ok = imwrite(result.path, mask);
+		if(!result.ok) result.error = "could not be written";
+	}
+	catch(std::exception& e) {
+		result.ok = false;
+		result.error = e.what();
+	}
+	result.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	return result;
+}
+
+std::vector<MaskFileResult> WriteSeparateMasks(const MaskState& state, const std::vector<int>& classes, const std::string& maskPath) {
+	// bounded - encoding is cpu heavy and every job holds one full size mask
+	static ThreadPool writers(std::max(2u, std::thread::hardware_concurrency() / 2));
+
+	const fs::path folder = fs::path(maskPath).parent_path();
+	const std::string name = fs::path(maskPath).stem().string();
+	std::vector<std::future<MaskFileResult>> jobs;
+	// the jobs get their own copy of the state (only the tile references are copied)
+	for(int c : classes) {
+		fs::path filePath = folder / std::to_string(c) / (name + std::to_string(c) + ".png");
+		jobs.push_back(writers.Submit([state, c, filePath] {
+			return writeMaskFile(filePath, [&] (Mat& mask) {
+				if(!state.labelMap.empty())
+					state.labelMap.ClassMask(c, mask);
+				else
+					state.classPlanes.at(c).ToMask(mask);
+			});
+		}));
+	}
+	fs::path backgroundPath = folder / "0" / (name + ".png");
+	jobs.push_back(writers.Submit([state, backgroundPath] {
+		return writeMaskFile(backgroundPath, [&] (Mat& mask) { BackgroundMask(state, mask); });
+	}));
+
+	std::vector<MaskFileResult> results;
+	for(auto& job : jobs)
+		results.push_back(job.get());
+	return results;
+}
+
+
+std::vector<int> ClassRemapTable(int numClasses, const std::vector<int>& from, int to, bool swap) {
+	int size = std::max(numClasses, to + 1);
+	for(int c : from) size = std::max(size, c + 1);
+	std::vector<int> lut(size);
+	for(int c = 0; c < size; c++) lut[c] = c;
+	for(int c : from)
+		if(c >= 0) lut[c] = to;
+	if(swap && !from.empty() && from[0] >= 0)
+		lut[to] = from[0];
+	return lut;
+}
+
+
+void RemapClasses(MaskState& state, const std::vector<int>& lut) {
+	auto mapped = [&](int c) { return c < lut.size() ? std::clamp(lut[c], 0, MAX_CLASSES - 1) : c; };
+	const int classes = std::max<int>(state.numClasses, static_cast<int>(state.classPlanes.size()));
+	for(int c = 0; c < std::min<int>(classes, static_cast<int>(lut.size())); c++)
+		state.numClasses = std::max(state.numClasses, mapped(c) + 1);
+
+	if(!state.labelMap.empty()) {
+		// table over the whole label range - one lookup per pixel
+		std::vector<ushort> table(MAX_CLASSES);
+		for(int i = 0; i < MAX_CLASSES; i++) table[i] = static_cast<ushort>(mapped(i));
+
+		LabelMap& labelMap = state.labelMap;
+		parallel_for_(Range(0, labelMap.tileCount()), [&](const Range& range) {
+			for(int t = range.start; t < range.end; t++) {
+				if(!labelMap.tile(t)) continue; // background stays background (unless class 0 is relabeled)
+				const Mat& labels = *labelMap.tile(t);
+				bool changes = false;
+				for(int y = 0; y < labels.rows && !changes; y++) {
+					const ushort* l = labels.ptr<ushort>(y);
+					for(int x = 0; x < labels.cols; x++)
+						if(table[l[x]] != l[x]) { changes = true; break; }
+				}
+				if(!changes) continue;
+
+				auto remapped = std::make_shared<Mat>(labels.size(), CV_16U);
+				bool nonZero = false;
+				for(int y = 0; y < labels.rows; y++) {
+					const ushort* l = labels.ptr<ushort>(y);
+					ushort* dst = remapped->ptr<ushort>(y);
+					for(int x = 0; x < labels.cols; x++) {
+						dst[x] = table[l[x]];
+						nonZero |= dst[x] != 0;
+					}
+				}
+				labelMap.setTile(t, nonZero ? remapped : nullptr);
+			}
+		});
+		// unallocated tiles are background - only a relabeled background fills them
+		if(mapped(0) != 0) {
+			for(int t = 0; t < labelMap.tileCount(); t++)
+				if(!labelMap.tile(t)) {
+					Rect rect = labelMap.tileRect(t);
+					labelMap.setTile(t, std::make_shared<Mat>(rect.height, rect.width, CV_16U, Scalar(mapped(0))));
+				}
+		}
+	} else {
+		// planes mapped onto the same class are merged - unchanged classes keep their plane (and tiles)
+		std::vector<BitPlane> planes(std::max<size_t>(state.numClasses, state.classPlanes.size()));
+		for(int c = 0; c < state.classPlanes.size(); c++) {
+			if(state.classPlanes[c].empty()) continue;
+			const int to = mapped(c);
+			if(to >= planes.size()) planes.resize(to + 1);
+			BitPlane& target = planes[to];
+			target = target.empty() ? state.classPlanes[c] : BitPlane::Or(target, state.classPlanes[c]);
+		}
+		state.classPlanes = std::move(planes);
+		state.numClasses = std::max<int>(state.numClasses, static_cast<int>(state.classPlanes.size()));
+	}
+}
+
+
+std::map<int, std::string> FindSeparateMasks(const std::string& folder, const std::string& name) {
+	std::map<int, std::string> masks;
+	if(!fs::is_directory(folder)) return masks;
+	for(const auto& classFolder : fs::directory_iterator(folder)) {
+		if(!classFolder.is_directory()) continue;
+		const std::string folderName = classFolder.path().filename().string();
+		if(folderName.empty() || folderName.size() > 5 || folderName.find_first_not_of("0123456789") != std::string::npos) continue;
+		const int classNr = std::stoi(folderName);
+		if(classNr > MAX_CLASSES - 1) continue;
+		for(const fs::path& candidate : { classFolder.path() / (name + ".png"), classFolder.path() / (name + folderName + ".png") }) {
+			if(fs::is_regular_file(candidate)) {
+				masks[classNr] = candidate.string();
+				break;
+			}
+		}
+	}
+	return masks;
+}
+
+
+static MaskFileResult remapLabelFile(const std::string& path, const std::vector<int>& lut) {
+	MaskFileResult result;
+	result.path = path;
+	auto start = std::chrono::high_resolution_clock::now();
+	Mat labels = ReadLabelImage(path);
+	if(labels.empty()) {
+		result.error = "could not be read";
+		return result;
+	}
+	Mat labels16;
+	labels.convertTo(labels16, CV_16U);
+	MaskState state;
+	state.size = labels16.size();
+	state.labelMap = LabelMap::FromMat(labels16);
+	double max = 0;
+	minMaxIdx(labels16, nullptr, &max);
+	state.numClasses = static_cast<int>(max) + 1;
+	const LabelMap before = state.labelMap;
+	RemapClasses(state, lut);
+	bool changed = false;
+	for(int t = 0; t < before.tileCount(); t++)
+		changed |= before.tile(t) != state.labelMap.tile(t);
+	if(!changed) { // none of the relabeled classes in this mask
+		result.ok = true;
+		return result;
+	}
+
+	Mat remapped;
+	state.labelMap.ToMat(remapped, state.numClasses <= 256 ? CV_8U : CV_16U);
+	try {
+		result.ok = imwrite(path, remapped);
+		if(!result.ok) result.error = "could not be written";
+	}
+	catch(std::exception& e) {
+		result.error = e.what();
+	}
+	result.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	return result;
+}
+
+static std::vector<MaskFileResult> remapSeparateFiles(const std::string& maskPath, const std::vector<int>& lut) {
+	const fs::path folder = fs::path(maskPath).parent_path();
+	const std::string name = fs::path(maskPath).stem().string();
+	std::map<int, std::string> files = FindSeparateMasks(folder.string(), name);
+	files.erase(0); // the background is written again from the remapped classes
+	if(files.empty()) return {};
+
+	MaskState state;
+	for(const auto& [classNr, file] : files) {
+		Mat mask = imread(file, IMREAD_GRAYSCALE);
+		if(mask.empty()) return { MaskFileResult{ file, 0, false, "could not be read" } };
+		if(state.size.empty()) state.size = mask.size();
+		if(mask.size() != state.size) return { MaskFileResult{ file, 0, false, "size differs from the other classes" } };
+		state.numClasses = classNr + 1;
+		state.classPlanes.resize(state.numClasses);
+		state.classPlanes[classNr] = BitPlane::FromMask(mask);
+	}
+	RemapClasses(state, lut);
+
+	std::vector<int> classes;
+	for(int c = 1; c < state.classPlanes.size(); c++)
+		if(!state.classPlanes[c].empty()) classes.push_back(c);
+	std::vector<MaskFileResult> results = WriteSeparateMasks(state, classes, maskPath);
+	// files of classes that are gone (relabeled and not target of another class) - kept if a write failed, 
+	// else the pixels merged into the unwritten class would be lost
+	const bool written = std::all_of(results.begin(), results.end(), [](const MaskFileResult& r) { return r.ok; });
+	for(const auto& [classNr, file] : files)
+		if(classNr >= state.classPlanes.size() || state.classPlanes[classNr].empty()) {
+			MaskFileResult removal;
+			removal.path = file;
+			if(!written)
+				removal.error = "not removed, the relabeled classes could not be written";
+			else {
+				std::error_code error;
+				removal.ok = fs::remove(file, error);
+				if(!removal.ok) removal.error = error ? error.message() : "could not be removed";
+			}
+			results.push_back(removal);
+		}
+	return results;
+}
+
+std::vector<MaskFileResult> RemapMaskFiles(const std::vector<std::string>& maskPaths, bool separateMasks, const std::vector<int>& lut,
+										   std::atomic<int>* filesDone) {
+	std::vector<std::vector<MaskFileResult>> results(maskPaths.size());
+	parallel_for_(Range(0, static_cast<int>(maskPaths.size())), [&](const Range& range) {
+		for(int i = range.start; i < range.end; i++) {
+			if(separateMasks)
+				results[i] = remapSeparateFiles(maskPaths[i], lut);
+			else if(fs::is_regular_file(maskPaths[i]))
+				results[i] = { remapLabelFile(maskPaths[i], lut) };
+			if(filesDone) (*filesDone)++;
+		}
+	});
+
+	std::vector<MaskFileResult> all;
+	for(auto& fileResults : results)
+		all.insert(all.end(), fileResults.begin(), fileResults.end());
+	return all;
+}
+
+
+void BenchmarkMaskLoading(int rows, int cols) {
+	if(rows <= 0 || cols <= 0) return;
+	for(int classes : { 3, 20, 255 }) {
+		Mat labels(rows, cols, CV_8U);
+		randu(labels, 0, classes);
+
+		{
+			// the former decoding: min max and one inRange pass per class
+			std::cout << "inRange per class (" << classes << " classes): ";
+			Timer timer;
+			UMat mask = labels.getUMat(ACCESS_READ);
+			double max, min;
+			minMaxIdx(mask, &min, &max);
+			std::vector<UMat> classMasks;
+			for(int i = static_cast<int>(max); i >= 0; i--) {
+				UMat classI;
+				inRange(mask, i, i, classI);
+				classMasks.insert(classMasks.begin(), classI);
+			}
+		}
+		{
+			std::cout << "single pass decoder, class planes (" << classes << " classes): ";
+			Timer timer;
+			MaskState state;
+			DecodeLabelImage(labels, true, state);
+		}
+		{
+			std::cout << "single pass decoder, label map (" << classes << " classes): ";
+			Timer timer;
+			MaskState state;
+			DecodeLabelImage(labels, false, state);
+		}
+	}
+}
@@ -0,0 +1,80 @@
+/*
+ * This file is part of PixLabelCV.
+ *
+ * Copyright (C) 2024 Dominik Schraml
+ *
+ * PixLabelCV is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Alternatively, commercial licenses are available. Please contact SQB Ilmenau
+ * at olaf.glaessner@sqb-ilmenau.de or dominik.schraml@sqb-ilmenau.de for more details.
+ *
+ * PixLabelCV is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PixLabelCV. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include "MaskState.h"
+#include <atomic>
+#include <string>
+#include <map>
+
+// Reads a label mask: 8 or 16 bit gray (CV_8U / CV_16U class number per pixel) or palette indexed PNG
+// (the palette index is the class number). Color images are converted to gray like before. Empty on failure.
+cv::Mat ReadLabelImage(const std::string& path);
+
+// Decodes the class numbers into the state in two passes: a histogram pass for the classes that are present
+// and one parallel pass that writes the label map or all class planes at once.
+int DecodeLabelImage(const cv::Mat& labels, bool multipleLabels, MaskState& state);
+
+// classes from lowest to highest priority: higher classes have higher priority (win where multiple labels overlap)
+std::vector<int> DefaultClassPriority(int numClasses);
+
+// Builds the label image (class number per pixel, CV_8U - or CV_16U for more than 256 classes) in one sweep over the tiles. For the class planes the class 
+// that comes last in priority wins; classes missing in priority are left out.
+void ComposeLabelImage(const MaskState& state, const std::vector<int>& priority, cv::Mat& labels);
+
+// 255 where no class (except background) is labeled, 0 elsewhere - one pass over the tiles
+void BackgroundMask(const MaskState& state, cv::Mat& mask);
+
+struct MaskFileResult {
+	std::string path;
+	double milliseconds = 0; // creating the mask, encoding and writing it
+	bool ok = false;
+	std::string error;
+};
+
+// Writes the binary masks of the classes into <folder of maskPath>/<class>/<name><class>.png and the background 
+// into <folder of maskPath>/0/<name>.png. All files are encoded and written concurrently on a bounded thread pool.
+// Returns one result per file (background last).
+std::vector<MaskFileResult> WriteSeparateMasks(const MaskState& state, const std::vector<int>& classes, const std::string& maskPath);
+
+// Class number lookup table (index = old class): identity, except that the classes in from become `to`
+// (replace, or merge if several classes are given). With swap `to` becomes from[0] at the same time.
+std::vector<int> ClassRemapTable(int numClasses, const std::vector<int>& from, int to, bool swap);
+
+// Relabels every class c as lut[c] (classes beyond the table keep their number) in one pass over the tiles.
+// Tiles without a relabeled pixel keep their pointer, so only the changed tiles end up in the undo history.
+// Class planes that are mapped onto the same class are merged (or).
+void RemapClasses(MaskState& state, const std::vector<int>& lut);
+
+// The mask files of the classes saved separately: <folder>/<class>/<name><class>.png (or <name>.png) by class number
+std::map<int, std::string> FindSeparateMasks(const std::string& folder, const std::string& name);
+
+// Applies the class lookup table to the saved masks (paths like for saving: <folder>/<name>.png) - all files are 
+// processed in parallel, missing ones are skipped. Label images are rewritten (8 bit if possible), for separate 
+// masks the class files are merged / moved, the background file is rewritten and the files of classes that 
+// no longer exist are removed (only if all files of the image were written). Returns one result per written or 
+// removed file. filesDone (optional) counts the processed mask paths, e.g. for a progress bar.
+std::vector<MaskFileResult> RemapMaskFiles(const std::vector<std::string>& maskPaths, bool separateMasks, const std::vector<int>& lut,
+										   std::atomic<int>* filesDone = nullptr);
+
+// compare the decoder with the former per class inRange decoding for 3, 20 and 255 classes - prints to the console
+void BenchmarkMaskLoading(int rows, int cols);
@@ -0,0 +1,59 @@
+/*
+ * This file is part of PixLabelCV.
+ *
+ * Copyright (C) 2024 Dominik Schraml
+ *
+ * PixLabelCV is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Alternatively, commercial licenses are available. Please contact SQB Ilmenau
+ * at olaf.glaessner@sqb-ilmenau.de or dominik.schraml@sqb-ilmenau.de for more details.
+ *
+ * PixLabelCV is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PixLabelCV. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include "BitPlane.h"
+#include "LabelMap.h"
+#include "ClassStats.h"
+#include <vector>
+#include <cstdint>
+
+const int MAX_CLASSES = 65536; // class numbers are stored in the 16 bit label map
+
+// One labeling state. When only one label per pixel is allowed (default) all classes are stored in a single 
+// label map holding the class number of each pixel. Only when multiple (ambiguous) labels are enabled one 
+// binary 0/255 mask per class is kept. Both are tiled - a new state shares all untouched tiles with the older ones.
+// A class plane that was never written is empty (default constructed) and costs no memory.
+struct MaskState {
+	cv::Size size;                     // of the image (and the masks)
+	LabelMap labelMap;                 // class number per pixel (single label mode)
+	std::vector<BitPlane> classPlanes; // bit packed binary mask per class (multiple label mode) - empty until written
+	int numClasses = 0;                // number of classes incl. background (0)
+	std::vector<int> dirtyTiles;       // tiles changed by the edit that created this state
+	MaskStats stats;                   // pixel counts and bounding boxes - updated from the dirty tiles
+
+	bool empty() const { return numClasses == 0; }
+	// memory of the allocated tiles (shared tiles are counted in every state that holds them)
+	int64_t bytes() const {
+		int64_t total = int64_t(labelMap.allocatedTiles()) * TILE_SIZE * TILE_SIZE * sizeof(ushort);
+		for(const BitPlane& plane : classPlanes)
+			total += int64_t(plane.allocatedTiles()) * sizeof(BitTile);
+		return total;
+	}
+};
+
+// An immutable, numbered version of the labeling state. It can be read from any thread (saving, overlays,
+// statistics, ...) while the annotator keeps editing - the tiles are shared with the newer versions and never changed.
+struct MaskSnapshot {
+	uint64_t version = 0; // increases with every published change
+	MaskState state;
+};
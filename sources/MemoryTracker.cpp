@@ -0,0 +1,79 @@
+/*
+ * This file is part of PixLabelCV.
+ *
+ * Copyright (C) 2024 Dominik Schraml
+ *
+ * PixLabelCV is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Alternatively, commercial licenses are available. Please contact SQB Ilmenau
+ * at olaf.glaessner@sqb-ilmenau.de or dominik.schraml@sqb-ilmenau.de for more details.
+ *
+ * PixLabelCV is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PixLabelCV. If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include "MemoryTracker.h"
+#include <iostream>
+
+const char* MemoryTracker::Name(MemoryOwner owner) {
+	switch(owner) {
+		case MemoryOwner::Image: return "image";
+		case MemoryOwner::ClassPlanes: return "class planes";
+		case MemoryOwner::History: return "history";
+		case MemoryOwner::Display: return "display";
+		case MemoryOwner::Cache: return "cache";
+		default: return "";
+	}
+}
+
+void MemoryTracker::raise(std::atomic<int64_t>& peakValue, int64_t value) {
+	int64_t current = peakValue;
+	while(value > current && !peakValue.compare_exchange_weak(current, value)) {}
+}
+
+void MemoryTracker::Add(MemoryOwner owner, int64_t bytes) {
+	if(bytes == 0) return;
+	raise(peak[index(owner)], live[index(owner)] += bytes);
+	raise(peakTotal, liveTotal += bytes);
+}
+
+void MemoryTracker::ResetPeaks() {
+	for(size_t i = 0; i < OWNERS; i++)
+		peak[i] = live[i].load();
+	peakTotal = liveTotal.load();
+}
+
+void MemoryTracker::AddEvictor(MemoryOwner owner, Evictor evictor) {
+	std::lock_guard<std::mutex> lock(evictorMutex);
+	evictors.emplace_back(owner, std::move(evictor));
+}
+
+bool MemoryTracker::Reserve(int64_t bytes) {
+	for(MemoryOwner owner : { MemoryOwner::Cache, MemoryOwner::History }) {
+		if(liveTotal + bytes <= budget) return true;
+		std::vector<Evictor> candidates;
+		{
+			std::lock_guard<std::mutex> lock(evictorMutex);
+			for(const auto& [evictorOwner, evictor] : evictors)
+				if(evictorOwner == owner) candidates.push_back(evictor);
+		}
+		// the evictors change the live bytes themselves (through their TrackedBytes)
+		for(const Evictor& evictor : candidates) {
+			int64_t over = liveTotal + bytes - budget;
+			if(over <= 0) break;
+			evicted[index(owner)] += evictor(over);
+		}
+	}
+	if(liveTotal + bytes <= budget) return true;
+	std::cout << "memory budget exceeded: " << (liveTotal + bytes) / (1024 * 1024) << " of " << budget / (1024 * 1024) << " MB\n";
+	shortfall = liveTotal + bytes - budget;
+	return false;
+}
@@ -0,0 +1,106 @@
+/*
+ * This file is part of PixLabelCV.
+ *
+ * Copyright (C) 2024 Dominik Schraml
+ *
+ * PixLabelCV is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Alternatively, commercial licenses are available. Please contact SQB Ilmenau
+ * at olaf.glaessner@sqb-ilmenau.de or dominik.schraml@sqb-ilmenau.de for more details.
+ *
+ * PixLabelCV is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PixLabelCV. If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+// who holds the memory - the owners are listed in the memory panel in this order
+enum class MemoryOwner { Image, ClassPlanes, History, Display, Cache, Count };
+
+// Live and peak bytes of the large buffers by owner and a budget for all of them together.
+// Owners that can give memory back (history, caches) register an evictor; Reserve() calls them before 
+// something large is allocated, so the budget holds as long as there is anything left to evict.
+class MemoryTracker
+{
+public:
+	static MemoryTracker& Instance() {
+		static MemoryTracker instance;
+		return instance;
+	}
+	static const char* Name(MemoryOwner owner);
+
+	void Add(MemoryOwner owner, int64_t bytes); // negative when freed
+	int64_t Live(MemoryOwner owner) const { return live[index(owner)]; }
+	int64_t Peak(MemoryOwner owner) const { return peak[index(owner)]; }
+	int64_t Evicted(MemoryOwner owner) const { return evicted[index(owner)]; }
+	int64_t LiveTotal() const { return liveTotal; }
+	int64_t PeakTotal() const { return peakTotal; }
+	void ResetPeaks();
+
+	void SetBudget(int64_t bytes) { budget = bytes; }
+	int64_t Budget() const { return budget; }
+
+	// frees (about) the requested bytes of the owner and returns the bytes actually freed
+	typedef std::function<int64_t(int64_t bytes)> Evictor;
+	void AddEvictor(MemoryOwner owner, Evictor evictor);
+	// makes room for an allocation: evicts caches first, then the oldest history steps - false if it still exceeds the budget
+	bool Reserve(int64_t bytes);
+	// bytes over the budget of the last failed Reserve since the last call (0: none) - for a warning in the UI
+	int64_t TakeShortfall() { return shortfall.exchange(0); }
+
+private:
+	MemoryTracker() {}
+	MemoryTracker(MemoryTracker const&);    // Don't Implement.
+	void operator = (MemoryTracker const&); // Don't implement 
+
+	static size_t index(MemoryOwner owner) { return static_cast<size_t>(owner); }
+	static void raise(std::atomic<int64_t>& peakValue, int64_t value);
+
+	static const size_t OWNERS = static_cast<size_t>(MemoryOwner::Count);
+	std::array<std::atomic<int64_t>, OWNERS> live{};
+	std::array<std::atomic<int64_t>, OWNERS> peak{};
+	std::array<std::atomic<int64_t>, OWNERS> evicted{};
+	std::atomic<int64_t> liveTotal{ 0 };
+	std::atomic<int64_t> peakTotal{ 0 };
+	std::atomic<int64_t> budget{ int64_t(4096) * 1024 * 1024 };
+	std::atomic<int64_t> shortfall{ 0 };
+
+	std::mutex evictorMutex;
+	std::vector<std::pair<MemoryOwner, Evictor>> evictors;
+};
+
+// The bytes of one buffer (or a group of buffers) of an owner - Set() reports the new size, the destructor frees it.
+class TrackedBytes
+{
+public:
+	explicit TrackedBytes(MemoryOwner owner) : owner(owner) {
+		MemoryTracker::Instance(); // constructed first, so it outlives static TrackedBytes
+	}
+	~TrackedBytes() { Set(0); }
+	void Set(int64_t newBytes) {
+		MemoryTracker::Instance().Add(owner, newBytes - bytes);
+		bytes = newBytes;
+	}
+	void Add(int64_t moreBytes) { Set(bytes + moreBytes); }
+	int64_t Bytes() const { return bytes; }
+
+private:
+	TrackedBytes(TrackedBytes const&);    // Don't Implement.
+	void operator = (TrackedBytes const&); // Don't implement 
+
+	MemoryOwner owner;
+	int64_t bytes = 0;
+};
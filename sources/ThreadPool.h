@@ -0,0 +1,104 @@
+/*
+ * This file is part of PixLabelCV.
+ *
+ * Copyright (C) 2024 Dominik Schraml
+ *
+ * PixLabelCV is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Alternatively, commercial licenses are available. Please contact SQB Ilmenau
+ * at olaf.glaessner@sqb-ilmenau.de or dominik.schraml@sqb-ilmenau.de for more details.
+ *
+ * PixLabelCV is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PixLabelCV. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+// Fixed number of worker threads for background jobs (compression, saving, ...).
+// The destructor finishes all queued jobs before the threads are joined.
+class ThreadPool
+{
+public:
+	explicit ThreadPool(size_t threads) {
+		for(size_t i = 0; i < std::max<size_t>(threads, 1); i++)
+			workers.emplace_back([this] { Work(); });
+	}
+	~ThreadPool() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		jobAdded.notify_all();
+		for(auto& worker : workers)
+			worker.join();
+	}
+
+	// queue a job - the future holds its result (or the exception it threw)
+	template<typename F>
+	auto Submit(F job) -> std::future<decltype(job())> {
+		auto task = std::make_shared<std::packaged_task<decltype(job())()>>(std::move(job));
+		auto result = task->get_future();
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			jobs.push([task] { (*task)(); });
+			pending++;
+		}
+		jobAdded.notify_one();
+		return result;
+	}
+
+	// blocks until all queued jobs are done
+	void Wait() {
+		std::unique_lock<std::mutex> lock(mutex);
+		jobDone.wait(lock, [this] { return pending == 0; });
+	}
+
+	size_t Size() const { return workers.size(); }
+
+private:
+	ThreadPool(ThreadPool const&);        // Don't Implement.
+	void operator = (ThreadPool const&);  // Don't implement 
+
+	void Work() {
+		while(true) {
+			std::function<void()> job;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				jobAdded.wait(lock, [this] { return stopping || !jobs.empty(); });
+				if(jobs.empty()) return; // stopping and nothing left to do
+				job = std::move(jobs.front());
+				jobs.pop();
+			}
+			job();
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				pending--;
+			}
+			jobDone.notify_all();
+		}
+	}
+
+	std::vector<std::thread> workers;
+	std::queue<std::function<void()>> jobs;
+	std::mutex mutex;
+	std::condition_variable jobAdded;
+	std::condition_variable jobDone;
+	size_t pending = 0;
+	bool stopping = false;
+};
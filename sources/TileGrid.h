@@ -0,0 +1,88 @@
+/*
+ * This file is part of PixLabelCV.
+ *
+ * Copyright (C) 2024 Dominik Schraml
+ *
+ * PixLabelCV is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Alternatively, commercial licenses are available. Please contact SQB Ilmenau
+ * at olaf.glaessner@sqb-ilmenau.de or dominik.schraml@sqb-ilmenau.de for more details.
+ *
+ * PixLabelCV is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PixLabelCV. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include "opencv2/core.hpp"
+#include <memory>
+#include <vector>
+
+const int TILE_SIZE = 256; // width and height of one tile in pixels
+
+// Image sized grid of TILE_SIZE x TILE_SIZE tiles (copy-on-write storage of the masks).
+// Tiles are immutable and shared by reference between copies of the grid - an edit replaces only the tiles 
+// it touches, every other tile stays shared with the earlier states. A null tile means all pixels are zero.
+template<typename Tile>
+class TileGrid
+{
+public:
+	typedef std::shared_ptr<const Tile> TilePtr;
+
+	TileGrid() {}
+	TileGrid(int rows, int cols) : rows(rows), cols(cols),
+		tilesX((cols + TILE_SIZE - 1) / TILE_SIZE), tilesY((rows + TILE_SIZE - 1) / TILE_SIZE) {
+		tiles.resize(static_cast<size_t>(tilesX) * tilesY);
+	}
+
+	int rows = 0;
+	int cols = 0;
+	int tilesX = 0;
+	int tilesY = 0;
+
+	bool empty() const { return tiles.empty(); } // no size (not: all zero)
+	int tileCount() const { return static_cast<int>(tiles.size()); }
+	// image region of the tile (clipped at the right and bottom border)
+	cv::Rect tileRect(int t) const {
+		int x = (t % tilesX) * TILE_SIZE, y = (t / tilesX) * TILE_SIZE;
+		return cv::Rect(x, y, std::min(TILE_SIZE, cols - x), std::min(TILE_SIZE, rows - y));
+	}
+	const TilePtr& tile(int t) const { return tiles[t]; }
+	void setTile(int t, TilePtr newTile) { tiles[t] = std::move(newTile); }
+
+	// indices of all tiles that intersect the rect
+	std::vector<int> tilesIn(cv::Rect rect) const {
+		std::vector<int> result;
+		rect &= cv::Rect(0, 0, cols, rows);
+		if(rect.empty()) return result;
+		for(int ty = rect.y / TILE_SIZE; ty <= (rect.y + rect.height - 1) / TILE_SIZE; ty++)
+			for(int tx = rect.x / TILE_SIZE; tx <= (rect.x + rect.width - 1) / TILE_SIZE; tx++)
+				result.push_back(ty * tilesX + tx);
+		return result;
+	}
+	// marks the tiles that are not shared with the other grid - an empty grid counts as all zero, 
+	// every tile is marked if the size differs otherwise
+	void markChangedTiles(const TileGrid& other, std::vector<uchar>& changed) const {
+		if(changed.size() < tiles.size()) changed.resize(tiles.size(), 0);
+		const bool sameSize = other.rows == rows && other.cols == cols;
+		for(size_t t = 0; t < tiles.size(); t++)
+			if(sameSize ? tiles[t] != other.tiles[t] : (!other.empty() || tiles[t] != nullptr))
+				changed[t] = 1;
+	}
+	int allocatedTiles() const {
+		int count = 0;
+		for(const auto& t : tiles)
+			if(t) count++;
+		return count;
+	}
+
+protected:
+	std::vector<TilePtr> tiles;
+};
@@ -101,74 +101,11 @@ bool LoadTextureFromFile(const char* filename, ID3D11ShaderResourceView** out_sr
     image_height = image.rows; 
     image_width = image.cols; 
 
-    // Create texture 
-    D3D11_TEXTURE2D_DESC desc;
-    ZeroMemory(&desc, sizeof(desc));
-    desc.Width = image_width;
-    desc.Height = image_height;
-    desc.MipLevels = 1;
-    desc.ArraySize = 1;
-    desc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
-    desc.SampleDesc.Count = 1;
-   // desc_rgba.SampleDesc.Quality = 0;
-    // USAGE_DYNAMIC-Texturen sind fr das Streaming von Daten von der CPU zur GPU und nicht nur fr GPU-Lesevorgnge optimiert.
-    // alternatives are described here
-    // https://learn.microsoft.com/de-de/windows/win32/direct3d11/how-to--use-dynamic-resources?redirectedfrom=MSDN
-    // https://learn.microsoft.com/de-de/windows/win32/direct3d11/overviews-direct3d-11-resources-textures-how-to-set_with_check-manually
-    desc.Usage = D3D11_USAGE_DYNAMIC; //D3D11_USAGE_DEFAULT; //D3D11_USAGE_DYNAMIC;
-    desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
-    //desc.CPUAccessFlags = 0;
-    desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
-
-    ID3D11Texture2D* pTexture = NULL;
-    g_pd3dDevice->CreateTexture2D(&desc, 0, &pTexture);
-
-    //DS: maybe save the texture descriptor in program state - it may be used to retrieve the texture from shaderResourceView back again
-
-    // Try to save the Subresource 
-    //// convert that matrix (or the image data) to D3d11 subresource    
-
-    // ***  DS: out 24.8.23
-    //D3D11_SUBRESOURCE_DATA tSData = {}; // difference between MAPPEDSUBRESOURCE AND SUBRESOURCE_DATA?
-    //tSData.pSysMem = &(pTexture[0]);
-    //tSData.SysMemPitch = desc.Width * 4;
-    //tSData.SysMemSlicePitch = 0;
-    // *** 24.8.23
-
-
-    //// Alternatively: 
-    //subResource.pSysMem = image.data;   
-    //subResource.SysMemPitch = desc.Width * 4;
-    //subResource.SysMemSlicePitch = 0;
-    //g_pd3dDevice->CreateTexture2D(&desc, &subResource, &pTexture);
-
-    // save to State (--> maybe remove)
-    //LabelState::Instance().textureSrData = & tSData; // DS: MEMORY LEAK !!!!!
-
-    // to prevent texture Type != source type 
-  /*  cv::UMat alpha(image_height, image_width, CV_8UC1); not needed here*/
- /*   cv::UMat image4channel;
-    int conversion[] = { 0, 0, 1, 1, 2, 2, -1, 3 };
-    //https://docs.opencv.org/4.5.3/d2/de8/group__core__array.html#ga51d768c270a1cdd3497255017c4504be
-    cv::mixChannels(&image, 2, &image4channel, 1, conversion, 4);*/
-    cv::Mat image_rgba; // maybe just one image needed
+    // the tiles are uploaded when they get visible
+    cv::Mat image_rgba;
     cv::cvtColor(image, image_rgba, cv::COLOR_BGR2RGBA); // If conversion adds the alpha channel, its value will set_with_check to the maximum of corresponding channel range: 255 for CV_8U,
-
-    cv::directx::convertToD3D11Texture2D(image_rgba, pTexture);
-    if (pTexture == nullptr) {
-        throw std::runtime_error("Texture Pointer is null");
-    }
-
-    // Create texture view
-    D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc;
-    ZeroMemory(&srvDesc, sizeof(srvDesc));
-    srvDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
-    srvDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
-    srvDesc.Texture2D.MipLevels = desc.MipLevels;
-    srvDesc.Texture2D.MostDetailedMip = 0;
-    g_pd3dDevice->CreateShaderResourceView(pTexture, &srvDesc, out_srv);
-
-    pTexture->Release();
+    DisplaySurface::Main().SetFrame(image_rgba);
+    DisplaySurface::Main().MarkAllDirty();
 
     *out_width = image_width;
     *out_height = image_height;
@@ -179,6 +116,74 @@ bool LoadTextureFromFile(const char* filename, ID3D11ShaderResourceView** out_sr
     return true;
 }
  
+bool UploadRGBATexture(const cv::Mat& rgba, ID3D11ShaderResourceView*& srv, ID3D11Device* device, ID3D11DeviceContext* context) {
+	CV_Assert(rgba.type() == CV_8UC4);
+	ID3D11Texture2D* texture = NULL;
+	D3D11_TEXTURE2D_DESC desc;
+	if(srv != nullptr) {
+		ID3D11Resource* res;
+		srv->GetResource(&res);
+		res->QueryInterface<ID3D11Texture2D>(&texture);
+		res->Release();
+		texture->GetDesc(&desc);
+		if(desc.Width != rgba.cols || desc.Height != rgba.rows) {
+			texture->Release();
+			texture = NULL;
+			srv->Release();
+			srv = nullptr;
+		}
+	}
+	if(srv == nullptr) {
+		// dynamic like the image texture, so it can be mapped for writing
+		ZeroMemory(&desc, sizeof(desc));
+		desc.Width = rgba.cols;
+		desc.Height = rgba.rows;
+		desc.MipLevels = 1;
+		desc.ArraySize = 1;
+		desc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+		desc.SampleDesc.Count = 1;
+		desc.Usage = D3D11_USAGE_DYNAMIC;
+		desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+		desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+		if(FAILED(device->CreateTexture2D(&desc, NULL, &texture)))
+			return false;
+
+		D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc;
+		ZeroMemory(&srvDesc, sizeof(srvDesc));
+		srvDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+		srvDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
+		srvDesc.Texture2D.MipLevels = desc.MipLevels;
+		srvDesc.Texture2D.MostDetailedMip = 0;
+		device->CreateShaderResourceView(texture, &srvDesc, &srv);
+	}
+
+	D3D11_MAPPED_SUBRESOURCE mapped;
+	bool ok = SUCCEEDED(context->Map(texture, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped));
+	if(ok) {
+		uint8_t* dst = (uint8_t*)mapped.pData;
+		for(int y = 0; y < rgba.rows; y++)
+			std::memcpy(dst + y * mapped.RowPitch, rgba.ptr(y), rgba.cols * 4);
+		context->Unmap(texture, 0);
+	}
+	texture->Release();
+	return ok;
+}
+
+bool D3D11TileUploader::Upload(int tile, const cv::Mat& rgba) {
+	if(views.size() <= tile) views.resize(tile + 1, nullptr);
+	ID3D11ShaderResourceView*& srv = views[tile];
+	return UploadRGBATexture(rgba, srv, device, context);
+}
+
+void D3D11TileUploader::Release() {
+	for(ID3D11ShaderResourceView*& srv : views)
+		if(srv != nullptr) {
+			srv->Release();
+			srv = nullptr;
+		}
+	views.clear();
+}
+ 
 int LoadImageAndMask(const std::string& current_img_path, ID3D11ShaderResourceView*& tex_shader_res_view, ID3D11Device* g_pd3dDevice, 
 					  int& image_width, int& image_height, bool seperate_masks, const std::string& mask_postfix) {
 
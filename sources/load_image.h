@@ -30,7 +30,29 @@
 
 namespace fs = std::filesystem;
 
+#include "DisplaySurface.h"
+
+// loads the image into the state and sets it as frame of DisplaySurface::Main() - out_srv is not used anymore,
+// the image is drawn tile by tile (so there is no limit on the image size by the maximum texture size)
 bool LoadTextureFromFile(const char* filename, ID3D11ShaderResourceView** out_srv, int* out_width, int* out_height, ID3D11Device* g_pd3dDevice);
+// copies the RGBA image into the dynamic texture - (re)created if it does not exist yet or has another size
+bool UploadRGBATexture(const cv::Mat& rgba, ID3D11ShaderResourceView*& srv, ID3D11Device* device, ID3D11DeviceContext* context);
+
+// one dynamic texture per display tile
+class D3D11TileUploader : public TileUploader
+{
+public:
+	D3D11TileUploader(ID3D11Device* device, ID3D11DeviceContext* context) : device(device), context(context) {}
+	~D3D11TileUploader() { Release(); }
+	bool Upload(int tile, const cv::Mat& rgba) override;
+	void* Texture(int tile) override { return tile < views.size() ? (void*)views[tile] : nullptr; }
+	void Release() override;
+
+private:
+	ID3D11Device* device;
+	ID3D11DeviceContext* context;
+	std::vector<ID3D11ShaderResourceView*> views;
+};
 
 //std::wstring utf8ToUtf16(const std::string& utf8Str) {
 //	std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>> conv;
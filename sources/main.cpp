@@ -37,8 +37,15 @@
 #include "load_image.h"  
 
 #include "LabelState.h"
+#include "MaskIO.h"
+#include "MemoryTracker.h"
+#include "BufferPool.h"
+#include "ClassOverlay.h"
+#include "FusedThreshold.h"
+#include "GrabCutSession.h"
 #include "ImageProcessing.h" 
 #include "Timer.h"
+#include "ThreadPool.h"
 #include "../resource.h" 
 #include "helper.h"
 #include "user_interaction.h"
@@ -68,6 +75,7 @@ void CleanupRenderTarget();
 LRESULT WINAPI WndProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam);
 
 cv::UMat ApplyCVOperation(ImageProcParameters params, float* color, CvOperation op);
+bool ApplyCVOperation(ImageProcParameters params, float* color, CvOperation op, cv::Mat& target, cv::Rect& changed);
 
 
 // Main code
@@ -162,6 +170,12 @@ int main(int, char**) {
 	ImVec4 clear_color = ImVec4(0.45f, 0.55f, 0.60f, 1.00f);
 	float picked_color[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
 	static ImageProcParameters ImPar = ImageProcParameters();
+	// label overlay layer: the class colors drawn over the image with the display alpha at draw time
+	static DisplaySurface overlay_surface;
+	static bool show_overlay = false;        // after Q until the next operation
+	static bool always_show_overlay = false;
+	static uint64_t overlay_version = 0;     // state version in the overlay texture
+	static bool overlay_changed = true;      // class visibility changed
 
 	std::vector<std::string> files_in_path;
 	std::string current_img_path;
@@ -175,6 +189,9 @@ int main(int, char**) {
 	bool ret = LoadTextureFromFile(img_file.c_str(), &tex_shader_res_view,
 								   &image_width, &image_height, g_pd3dDevice);
 	IM_ASSERT(ret); //DS: is pointless now - changed to display hint text img 
+	// textures of the display tiles - only the changed and visible ones are uploaded each frame
+	D3D11TileUploader image_tiles(g_pd3dDevice, g_pd3dDeviceContext);
+	D3D11TileUploader overlay_tiles(g_pd3dDevice, g_pd3dDeviceContext);
 
 	static int last_draw_shape = 0;
 	static bool drawClassRegion;
@@ -235,6 +252,16 @@ int main(int, char**) {
 	static bool open_replace_class_window = false;
 	static Timer labelTimer = Timer();
 
+	// relabeling the masks of the folder runs in the background - no saving until it is finished
+	static ThreadPool relabel_worker(1);
+	static std::future<std::vector<MaskFileResult>> relabel_job;
+	static std::atomic<int> relabel_files_done{ 0 };
+	static int relabel_files = 0;
+	static std::string relabel_open_img; // relabeled in memory, its mask file is left out
+	static std::chrono::high_resolution_clock::time_point relabel_start;
+	static std::string batch_report;
+	const std::string relabel_busy = "The masks of the folder are being relabeled. Please save when that is finished.";
+
 
 #ifdef DEBUG
 	std::cout << cv::getBuildInformation() << std::endl;
@@ -319,10 +346,18 @@ int main(int, char**) {
 			// ImGuiWindowFlags_NoDecoration is not usable as it disable the Horizontal Scrollbar
 			ImGui::Begin("Image to draw Labels on ", p_open, flags);  // define flags before so that they may be changed
 
-			ImTextureID textureId = (void*)tex_shader_res_view;
+			// the overlay layer follows the state - only updated and uploaded when the state or the class visibility changed
+			const bool draw_overlay = (show_overlay || always_show_overlay) && ImPar.overlayLayer;
+			if(draw_overlay && (overlay_changed || overlay_version != LabelState::Instance().Version())) {
+				overlay_version = LabelState::Instance().Version();
+				const cv::Mat& overlay = ClassOverlay::Instance().Update(LabelState::Instance().GetCurrentState());
+				if(!overlay.empty())
+					overlay_surface.SetFrame(overlay, ClassOverlay::Instance().UpdatedRects());
+				overlay_changed = false;
+			}
+
 			ImVec2 textureSize = ImVec2(image_width, image_height);
 			// ImGuiIO& io = ImGui::GetIO();
-			// ImTextureID textureId = io.Fonts->TexID;
 			// ImVec2 textureSize = ImVec2(io.Fonts->TexWidth, io.Fonts->TexHeight);
 
 			if(zoom.current >= zoom.min) {
@@ -330,8 +365,34 @@ int main(int, char**) {
 				// because currently position after zoom is oriented on the upper left corner
 				textureSize = ImVec2(zoom.current * image_width, zoom.current * image_height);
 			}
-			// better use Image than ImageButton 
-			ImGui::Image(textureId, textureSize);
+			// the image is drawn tile by tile: the item only reserves the space
+			const ImVec2 image_origin = ImGui::GetCursorScreenPos();
+			ImGui::Dummy(textureSize);
+			{
+				DisplaySurface& surface = DisplaySurface::Main();
+				const float scale = surface.Size().width > 0 ? textureSize.x / surface.Size().width : 1.0f;
+				ImDrawList* drawList = ImGui::GetWindowDrawList();
+				const ImVec2 clipMin = drawList->GetClipRectMin(), clipMax = drawList->GetClipRectMax();
+				const cv::Rect visible(cv::Point(cvFloor((clipMin.x - image_origin.x) / scale), cvFloor((clipMin.y - image_origin.y) / scale)),
+									   cv::Point(cvCeil((clipMax.x - image_origin.x) / scale), cvCeil((clipMax.y - image_origin.y) / scale)));
+				auto drawTiles = [&](DisplaySurface& tiles, TileUploader& uploader, ImU32 tint) {
+					tiles.Upload(visible, uploader);
+					for(int t : tiles.TilesIn(visible)) {
+						void* texture = uploader.Texture(t);
+						if(texture == nullptr) continue;
+						const cv::Rect rect = tiles.TileRect(t);
+						// half a texel inset - the sampler wraps, so the tile borders would blend with the opposite side
+						const ImVec2 uv0(0.5f / rect.width, 0.5f / rect.height);
+						drawList->AddImage(texture, ImVec2(image_origin.x + rect.x * scale, image_origin.y + rect.y * scale),
+										   ImVec2(image_origin.x + rect.br().x * scale, image_origin.y + rect.br().y * scale),
+										   uv0, ImVec2(1 - uv0.x, 1 - uv0.y), tint);
+					}
+				};
+				drawTiles(surface, image_tiles, IM_COL32_WHITE);
+				// alpha and visibility of the layer are applied by the GPU - changing them costs nothing here
+				if(draw_overlay && overlay_surface.Size() == surface.Size() && !LabelState::Instance().GetCurrentState().empty())
+					drawTiles(overlay_surface, overlay_tiles, ImGui::GetColorU32(ImVec4(1, 1, 1, alpha)));
+			}
 
 			bool isHovered = ImGui::IsItemHovered();
 			bool isFocused = ImGui::IsItemFocused();
@@ -469,7 +530,10 @@ int main(int, char**) {
 				save_key = true;
 			}
 			// saving the results on CTRL + D Key
-			if(io.KeyCtrl && ImGui::IsKeyPressed(68)) {
+			if(io.KeyCtrl && ImGui::IsKeyPressed(68) && relabel_job.valid()) {
+				WarningMessage = relabel_busy;
+				show_message = true;
+			} else if(io.KeyCtrl && ImGui::IsKeyPressed(68)) {
 				int return_code = SaveLabels(files_in_path, seperateMasks, current_img_path, tex_shader_res_view, image_width, image_height, mask_postfix);
 				//save_key = false;
 			}
@@ -530,6 +594,10 @@ int main(int, char**) {
 				// display the changes after the undo step (to show difference to user)
 				drawClassRegion = true;
 				ImPar.drawAllClasses = true;
+			} else if(ImGui::IsKeyPressed(89) && io.KeyCtrl) { // Strg + Y Key to redo 
+				LabelState::Instance().Redo();
+				drawClassRegion = true;
+				ImPar.drawAllClasses = true;
 			} else if( ImGui::IsKeyPressed(82) && io.KeyCtrl) {// Strg + R Key to open a window for replace all pixels of a class with another	
 				open_replace_class_window = !open_replace_class_window;
 			}else if(ImGui::IsKeyPressed(68)) {  // D key
@@ -573,15 +641,27 @@ int main(int, char**) {
 						 ImGuiWindowFlags_HorizontalScrollbar |
 						 ImGuiWindowFlags_AlwaysAutoResize);
 			const char* items[] = { "RGB", "HSV" }; 
-			const char* n_classes[] = { "0", "1", "2", "3", "4", "5", "6", "7", "8", "9", "10",
-											   "11", "12", "13", "14", "15", "16", "17", "18", "19" };
-			//const char* n_classes[] = { "Hintergrund", "Pruefobjekt", "Einfallstelle", "Flash", "Schlieren", "Dieseleffekt" };
  
 			static int colorspace = 0;
 
 			static int active_class = LabelState::Instance().GetActiveClass();
 
-			ImGui::Combo("active class", &active_class, n_classes, IM_ARRAYSIZE(n_classes));
+			active_class = LabelState::Instance().GetActiveClass();
+			ImGui::InputInt("active class", &active_class);
+			active_class = std::clamp(active_class, 0, MAX_CLASSES - 1);
+			ImGui::SameLine();
+			{
+				cv::Vec3b col = ClassColor(active_class);
+				ImGui::ColorButton("##classcolor", ImVec4(col[0] / 255.f, col[1] / 255.f, col[2] / 255.f, 1.f));
+				ImGui::SameLine();
+				bool class_visible = ClassOverlay::Instance().ClassVisible(active_class);
+				if(ImGui::Checkbox("visible", &class_visible)) {
+					ClassOverlay::Instance().SetClassVisible(active_class, class_visible);
+					overlay_changed = true;
+				}
+				if(ImGui::IsItemHovered())
+					ImGui::SetTooltip("Show the class in the overlay of all classes (Q).");
+			}
 			if(active_class != LabelState::Instance().GetActiveClass()) { // change classes via GUI
 				if(LabelState::Instance().ChangeActiveClass(active_class))
 					std::cout << "switched class to " << active_class << " (via gui) \n";
@@ -634,6 +714,9 @@ int main(int, char**) {
 										picked_color[2], out_h, out_s, out_v);
 
 			ImGui::SliderFloat("Alpha to display class", &alpha, 0.0f, 1.0f);
+			ImGui::Checkbox("Always show all classes", &always_show_overlay);
+			if(ImGui::IsItemHovered())
+				ImGui::SetTooltip("Draws the colors of all classes over the image (like Q) also while working on the temporary mask.");
 			ImGui::NewLine();
 			ImGui::Checkbox("Fill region", &fill_inner_pixels);
 			if(ImGui::IsItemHovered())
@@ -662,7 +745,11 @@ int main(int, char**) {
 #pragma region BottonsForImageInteraction
 
 			// Save results and load new image
-			if(ImGui::Button("Save Result") || save_key) {
+			const bool save_clicked = ImGui::Button("Save Result") || save_key;
+			if(save_clicked && relabel_job.valid()) {
+				WarningMessage = relabel_busy;
+				show_message = true;
+			} else if(save_clicked) {
 				int return_code = SaveLabels(files_in_path, seperateMasks, current_img_path, tex_shader_res_view, image_width, image_height, mask_postfix);
 
 				// load the next image 
@@ -890,7 +977,8 @@ int main(int, char**) {
 							ImGui::Text("\"%s\" %d", ImGui::GetKeyName(key), key);
 							std::string debugstr = ImGui::GetKeyName(key);
 							active_class += 10;// classes 10-19
-						} // classes 20 -29 may be added with Shift or Ctrl
+						}
+						if(ImGui::IsKeyDown(ImGuiKey_LeftShift)) active_class += 20; // classes 20-39
 						if(LabelState::Instance().ChangeActiveClass(active_class))
 							std::cout << "switched class to " << active_class << "\n";
 					}
@@ -927,21 +1015,114 @@ int main(int, char**) {
 			ImGui::End();
 		}
 
+		// nothing left to evict for the last allocation
+		if(const int64_t shortfall = MemoryTracker::Instance().TakeShortfall()) {
+			WarningMessage = "The memory budget (" + std::to_string(MemoryTracker::Instance().Budget() / (1024 * 1024)) + " MB) is exceeded by " +
+				std::to_string(shortfall / (1024 * 1024) + 1) + " MB, the undo history and the caches are freed already.\n"
+				"Operations that do not fit are skipped. Raise the budget in the expert window or load a smaller image.";
+			show_message = true;
+		}
+
+		// the masks of the folder are relabeled
+		if(relabel_job.valid() && relabel_job.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+			try {
+				std::vector<MaskFileResult> results = relabel_job.get();
+				double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - relabel_start).count();
+				int failed = 0;
+				for(const MaskFileResult& file : results) {
+					if(file.ok) continue;
+					failed++;
+					std::cout << " " << file.path << " FAILED (" << file.error << ")\n";
+				}
+				batch_report = std::to_string(results.size()) + " mask files relabeled in " + std::to_string(static_cast<int>(ms)) + " ms" +
+					(failed > 0 ? ", " + std::to_string(failed) + " failed (see console)" : "");
+			}
+			catch(std::exception& e) {
+				batch_report = std::string("Relabeling the masks failed: ") + e.what();
+			}
+			// an image opened meanwhile has the old classes in memory - load its relabeled masks before it can be saved
+			if(current_img_path != relabel_open_img) {
+				int ret = LoadImageAndMask(current_img_path, tex_shader_res_view, g_pd3dDevice, image_width, image_height, seperateMasks, mask_postfix);
+				if(ret <= -1) {
+					WarningMessage = "An error occured loading the relabeled masks of the image.";
+					show_message = true;
+				}
+				drawClassRegion = true;
+				ImPar.drawAllClasses = true;
+			}
+		}
+
 		// Class replacement window 
 		if (open_replace_class_window) {
             //ImGui::Begin("Change class label", &show_timer_window, ImGuiWindowFlags_NoResize | ImGuiWindowFlags_NoCollapse);
             ImGui::Begin("Change class label", &open_replace_class_window, ImGuiWindowFlags_NoCollapse || ImGuiWindowFlags_AlwaysAutoResize);
-			std::string infoTxt = "Select a class index and push the button to reassign all it's pixels in the selected area to the active class.";
-            ImGui::TextWrapped(infoTxt.c_str()); 
-			static int classlabel_to_replace = 0;
-            ImGui::InputInt("Class to replace ", &classlabel_to_replace, 1, 29, ImGuiInputTextFlags_AlwaysOverwrite);
-             
-            if (ImGui::Button("Replace with active class")) { 
-                ImPar.replaceClass(classlabel_to_replace); 
+			ImGui::TextWrapped("Relabel classes as the active class (%d): enter one class to replace it, several (e.g. \"3, 5, 7\") to merge them or swap the first one with the active class.", LabelState::Instance().GetActiveClass());
+			static char classes_to_replace[128] = "";
+			ImGui::InputText("Classes to replace", classes_to_replace, IM_ARRAYSIZE(classes_to_replace), ImGuiInputTextFlags_CallbackCharFilter,
+							 [](ImGuiInputTextCallbackData* data) { return (data->EventChar == ',' || data->EventChar == ' ') ? 0 : (data->EventChar < '0' || data->EventChar > '9'); });
+			static bool swap_classes = false;
+			ImGui::Checkbox("Swap with the active class", &swap_classes);
+
+			std::vector<int> from_classes;
+			{
+				std::string list = classes_to_replace;
+				std::replace(list.begin(), list.end(), ',', ' ');
+				std::istringstream numbers(list);
+				int classNr;
+				while(numbers >> classNr)
+					if(classNr >= 0 && classNr < MAX_CLASSES) from_classes.push_back(classNr);
+			}
+			std::vector<int> remap_table = ClassRemapTable(LabelState::Instance().MasksSize(), from_classes, LabelState::Instance().GetActiveClass(), swap_classes);
+			// class 0 is every unlabeled pixel in the label map - relabeling it would label the whole rest of the image
+			const bool replaces_background = std::find(from_classes.begin(), from_classes.end(), 0) != from_classes.end();
+			if(replaces_background)
+				ImGui::TextWrapped("The background (0) is every unlabeled pixel and cannot be relabeled - draw the region with the active class instead.");
+
+			ImGui::BeginDisabled(from_classes.empty() || replaces_background);
+			// one lookup table pass over the label map or class planes - one undo step
+			if(ImGui::Button("Whole image")) {
+				LabelState::Instance().RemapClasses(remap_table);
+				drawClassRegion = true;
+				ImPar.drawAllClasses = true;
+			}
+			ImGui::SameLine();
+			// only the pixels of the first class inside the drawn shape
+			if(ImGui::Button("Selected area only")) { 
+				ImPar.replaceClass(from_classes.front());
 				replace_class = true;  
 				evaluate = true;
-            } 
-			ImGui::TextWrapped("Reassignment is done automatically. Strg + Z to undo."); 
+			}
+			ImGui::SameLine();
+			// the current image is relabeled in memory (undoable, saved as usual) - the masks of all other images on disk, 
+			// on the worker (the result is collected above)
+			ImGui::BeginDisabled(files_in_path.empty() || relabel_job.valid());
+			if(ImGui::Button("All masks in folder")) {
+				std::vector<std::string> mask_paths;
+				for(const std::string& file : files_in_path) {
+					if(file == current_img_path) continue;
+					fs::path img_path(file);
+					mask_paths.push_back((img_path.parent_path() / "mask" / (img_path.stem().string() + mask_postfix + ".png")).string());
+				}
+				relabel_start = std::chrono::high_resolution_clock::now();
+				relabel_files_done = 0;
+				relabel_files = static_cast<int>(mask_paths.size());
+				relabel_open_img = current_img_path;
+				const bool separate = seperateMasks;
+				relabel_job = relabel_worker.Submit([mask_paths, separate, remap_table] {
+					return RemapMaskFiles(mask_paths, separate, remap_table, &relabel_files_done);
+				});
+				batch_report.clear();
+				LabelState::Instance().RemapClasses(remap_table);
+				drawClassRegion = true;
+				ImPar.drawAllClasses = true;
+			}
+			ImGui::EndDisabled();
+			ImGui::EndDisabled();
+			if(relabel_job.valid())
+				ImGui::ProgressBar(relabel_files > 0 ? float(relabel_files_done) / relabel_files : 1.0f, ImVec2(-1, 0), 
+								   (std::to_string(relabel_files_done) + " / " + std::to_string(relabel_files) + " images").c_str());
+			else if(!batch_report.empty()) ImGui::TextWrapped("%s", batch_report.c_str());
+			ImGui::TextWrapped("Reassignment is done automatically. Strg + Z to undo (not for the masks of the other images)."); 
 			ImGui::End();
 		}
 
@@ -969,7 +1150,7 @@ int main(int, char**) {
 			ImGui::NewLine();
 
 			ImGui::Text("Keyboard Shortcuts for efficiency: \n");
-			ImGui::Text("Switch classes with number keys(Alt for 10 - 19).\n");
+			ImGui::Text("Switch classes with number keys(Alt adds 10, Shift adds 20) or type any class number into the active class field.\n");
 			ImGui::Text("A : Add region to class mask.\n");
 			ImGui::Text("D : Display active class region.\n");
 			ImGui::Text("S : Apply theresholding (same as right-click)\n");
@@ -981,7 +1162,8 @@ int main(int, char**) {
 			ImGui::Text("R : Reset drawn elements\n");
 			ImGui::Text("H : Help window toggle.\n");
 			ImGui::Text("T : Tool switching.\n");
-			ImGui::Text("Ctrl + Z : Undo. (undo again to 'redo')\n");
+			ImGui::Text("Ctrl + Z : Undo.\n");
+			ImGui::Text("Ctrl + Y : Redo.\n");
 			ImGui::Text("Ctrl + S : Save and load next image\n");
 			ImGui::Text("Ctrl + D : Save the current mask\n");
 			ImGui::NewLine();
@@ -1099,10 +1281,129 @@ int main(int, char**) {
 			ImGui::Checkbox("Save Classes seperately ", &seperateMasks);
 			if(ImGui::IsItemHovered())
 				ImGui::SetTooltip("Save each mask in a seperate (binary 0 or 255) file instead of one PNG.\nEnable this option AND the multiple class labels flag if you want a pixel to be able to belong to multiple class labels (like car and tire).");
-			ImGui::Checkbox("Enable multiple (ambiguous) class label for pixels", &multipleClassLabels);
+			if(ImGui::Checkbox("Enable multiple (ambiguous) class label for pixels", &multipleClassLabels))
+				LabelState::Instance().SetMultipleLabels(multipleClassLabels); // converts the current masks
 			if(ImGui::IsItemHovered())
 				ImGui::SetTooltip("Allow each Pixel to have more than one label (like part and scratch). \nEnable this option to be able to assign more than one label to each pixel. \nThe overwrite other pixels label is then ignored and only the background class can be used to reset class labels. \nMultiple labels can only be saved correctly if the Save Classes seperately option is active.");
 			ImGui::NewLine();
+			static bool cpu_overlay_blend = false;
+			if(ImGui::Checkbox("Blend the class colors on the CPU", &cpu_overlay_blend))
+				ImPar.overlayLayer = !cpu_overlay_blend;
+			if(ImGui::IsItemHovered())
+				ImGui::SetTooltip("Reference for the overlay layer: Q blends the class colors into the image on the CPU instead of drawing them as a separate layer.");
+			const char* watershed_modes[] = { "Full image", "Markers ROI", "Coarse to fine" };
+			ImGui::Combo("Watershed", &ImPar.watershedMode, watershed_modes, IM_ARRAYSIZE(watershed_modes));
+			if(ImGui::IsItemHovered())
+				ImGui::SetTooltip("Full image: the watershed covers the whole image.\nMarkers ROI: only the bounding box of the markers plus the margin - the labels outside are kept.\nCoarse to fine: a downscaled image first, then only a band around the boundaries at full resolution.\nThe time of each run is printed to the console.");
+			if(ImPar.watershedMode == WatershedMarkersRoi)
+				ImGui::SliderInt("Margin (px)", &ImPar.watershedMargin, 0, 1024);
+			else if(ImPar.watershedMode == WatershedCoarseToFine)
+				ImGui::SliderInt("Pyramid levels", &ImPar.watershedLevels, 1, 5);
+			if(ImGui::TreeNode("GrabCut")) {
+				ImGui::SliderInt("Background margin (px)", &ImPar.grabCutMargin, 0, 256);
+				ImGui::SliderInt("Max iterations", &ImPar.grabCutMaxIterations, 1, 20);
+				ImGui::SliderFloat("Stop below change", &ImPar.grabCutConvergence, 0.0f, 0.05f, "%.4f");
+				if(ImGui::IsItemHovered())
+					ImGui::SetTooltip("Fraction of the region that switched between fore- and background in the last iteration.");
+				ImGui::SliderInt("Time budget (ms)", &ImPar.grabCutBudgetMs, 50, 10000);
+				if(ImGui::IsItemHovered())
+					ImGui::SetTooltip("New scribbles resume the last segmentation (its models and mask) as long as the earlier scribbles are unchanged.\nIterations stop when the segmentation is stable or the time budget is used up.");
+				ImGui::SliderInt("Coarse levels", &ImPar.grabCutLevels, 0, 4);
+				if(ImGui::IsItemHovered())
+					ImGui::SetTooltip("0: full resolution. Else the region is segmented halved this many times first,\nat full resolution only a band around the boundary is cut again.");
+				if(ImPar.grabCutLevels > 0)
+					ImGui::SliderInt("Band width (px)", &ImPar.grabCutBand, 1, 32);
+				if(ImGui::Checkbox("Run in the background", &ImPar.grabCutAsync) && !ImPar.grabCutAsync)
+					GrabCutSession::Instance().Cancel();
+				if(ImGui::IsItemHovered())
+					ImGui::SetTooltip("The overlay is updated after each iteration, the UI does not wait for the segmentation.\nAdding or removing scribbles cancels the running segmentation and restarts it.");
+				if(ImGui::Button("Benchmark coarse to fine")) {
+					// the images of the folder are the reference set
+					std::vector<std::string> reference(files_in_path.begin(), files_in_path.begin() + std::min<size_t>(files_in_path.size(), 10));
+					BenchmarkGrabCut(reference, std::max(ImPar.grabCutLevels, 1));
+				}
+				if(ImGui::IsItemHovered())
+					ImGui::SetTooltip("Latency and IoU of coarse to fine against full resolution on up to 10 images of the current folder\n(with the same strokes in each). The results are printed to the console.");
+				ImGui::TreePop();
+			}
+			ImGui::Checkbox("Fused threshold preview", &ImPar.fusedThreshold);
+			if(ImGui::IsItemHovered())
+				ImGui::SetTooltip("Computes the mask and the blended preview of the rectangle threshold in one pass.\nDisable to compare with inRange, setTo, addWeighted and the conversion to RGBA.");
+			MaskHistory& history = LabelState::Instance().History();
+			static int history_budget_mb = static_cast<int>(history.Budget() / (1024 * 1024));
+			ImGui::Text("Undo history: %d steps (%d redo), %.2f MB", history.UndoSteps(), history.RedoSteps(), history.Bytes() / (1024.0 * 1024.0));
+			ImGui::Text("State version: %llu", static_cast<unsigned long long>(LabelState::Instance().Version()));
+			if(ImGui::SliderInt("History budget (MB)", &history_budget_mb, 1, 1024))
+				history.SetBudget(static_cast<size_t>(history_budget_mb) * 1024 * 1024);
+			if(ImGui::IsItemHovered())
+				ImGui::SetTooltip("The oldest undo steps are dropped when the history needs more memory.");
+			if(ImGui::TreeNode("Delta sizes")) {
+				std::vector<size_t> sizes = history.DeltaSizes();
+				for(size_t i = 0; i < sizes.size(); i++)
+					ImGui::Text("step %d: %.1f kB", static_cast<int>(i), sizes[i] / 1024.0);
+				ImGui::TreePop();
+			}
+			if(ImGui::TreeNode("Memory")) {
+				MemoryTracker& memory = MemoryTracker::Instance();
+				const double MB = 1024.0 * 1024.0;
+				if(ImGui::BeginTable("memory", 4, ImGuiTableFlags_Borders | ImGuiTableFlags_SizingFixedFit)) {
+					ImGui::TableSetupColumn("owner");
+					ImGui::TableSetupColumn("live MB");
+					ImGui::TableSetupColumn("peak MB");
+					ImGui::TableSetupColumn("evicted MB");
+					ImGui::TableHeadersRow();
+					for(int i = 0; i < static_cast<int>(MemoryOwner::Count); i++) {
+						MemoryOwner owner = static_cast<MemoryOwner>(i);
+						ImGui::TableNextRow();
+						ImGui::TableNextColumn(); ImGui::Text("%s", MemoryTracker::Name(owner));
+						ImGui::TableNextColumn(); ImGui::Text("%.1f", memory.Live(owner) / MB);
+						ImGui::TableNextColumn(); ImGui::Text("%.1f", memory.Peak(owner) / MB);
+						ImGui::TableNextColumn(); ImGui::Text("%.1f", memory.Evicted(owner) / MB);
+					}
+					ImGui::TableNextRow();
+					ImGui::TableNextColumn(); ImGui::Text("total");
+					ImGui::TableNextColumn(); ImGui::Text("%.1f", memory.LiveTotal() / MB);
+					ImGui::TableNextColumn(); ImGui::Text("%.1f", memory.PeakTotal() / MB);
+					ImGui::EndTable();
+				}
+				static int memory_budget_mb = static_cast<int>(memory.Budget() / (1024 * 1024));
+				if(ImGui::SliderInt("Memory budget (MB)", &memory_budget_mb, 256, 32768))
+					memory.SetBudget(int64_t(memory_budget_mb) * 1024 * 1024);
+				if(ImGui::IsItemHovered())
+					ImGui::SetTooltip("Before large buffers are allocated caches and then the oldest undo steps are dropped to stay below this budget.");
+				if(ImGui::Button("Reset peaks"))
+					memory.ResetPeaks();
+				static bool reuse_buffers = BufferPool::Instance().Enabled();
+				if(ImGui::Checkbox("Reuse operation buffers", &reuse_buffers))
+					BufferPool::Instance().SetEnabled(reuse_buffers);
+				if(ImGui::IsItemHovered())
+					ImGui::SetTooltip("Keeps the full size temporaries of the operations between the evaluations.\nDisable to compare with allocating them every time (the counts per operation are printed to the console).");
+				BufferPool::Counters buffers = BufferPool::Instance().Totals();
+				ImGui::Text("Buffers: %d allocated (%.1f ms), %d reused", buffers.allocations, buffers.allocationMs, buffers.reuses);
+				ImGui::TreePop();
+			}
+			if(ImGui::Button("Benchmark mask algebra"))
+				BenchmarkBitPlanes(LabelState::Instance().h(), LabelState::Instance().w());
+			if(ImGui::IsItemHovered())
+				ImGui::SetTooltip("Compares the bit packed class masks of the multiple label mode with byte masks at the size of the current image.\nThe timings are printed to the console.");
+			ImGui::SameLine();
+			if(ImGui::Button("Benchmark mask loading"))
+				BenchmarkMaskLoading(LabelState::Instance().h(), LabelState::Instance().w());
+			if(ImGui::IsItemHovered())
+				ImGui::SetTooltip("Compares the mask decoding with the former one inRange per class for 3, 20 and 255 classes at the size of the current image.\nThe timings are printed to the console.");
+			const DisplaySurface::Counters& display = DisplaySurface::Main().counters;
+			ImGui::Text("Display: %d frames, %d changed tiles, %d uploaded (%.1f MB)", display.frames, display.changedTiles,
+						display.uploadedTiles, display.uploadedBytes / (1024.0 * 1024.0));
+			if(ImGui::Button("Benchmark threshold preview"))
+				BenchmarkThresholdKernel(LabelState::Instance().h(), LabelState::Instance().w());
+			if(ImGui::IsItemHovered())
+				ImGui::SetTooltip("Compares the fused threshold kernel with the separate OpenCV calls (RGB and HSV) at the size of the current image.\nThe timings are printed to the console.");
+			ImGui::SameLine();
+			if(ImGui::Button("Benchmark display upload"))
+				BenchmarkDisplaySurface(LabelState::Instance().h(), LabelState::Instance().w());
+			if(ImGui::IsItemHovered())
+				ImGui::SetTooltip("Compares the former full frame copy with the tiled upload of a small ROI change, a full frame change and a partly visible frame at the size of the current image.\nThe timings are printed to the console.");
+			ImGui::NewLine();
 			ImGui::Checkbox("Display image name", &show_img_name);
 			if(ImGui::IsItemHovered())
 				ImGui::SetTooltip("Displays the name of the currently loaded image. Allows you to copy the filename with a right click on it.");
@@ -1124,6 +1425,20 @@ int main(int, char**) {
 		}
 
 
+		// GrabCut in the background: changed scribbles restart it, each published iteration is shown
+		static size_t grabcut_scribbles = 0; // of the running job
+		bool grabcut_progress = false;
+		if(ImPar.grabCutAsync && current_draw_shape == CutsD) {
+			GrabCutSession& session = GrabCutSession::Instance();
+			if(session.Active() && !is_drawing_brush && brush_point_details.size() != grabcut_scribbles) {
+				if(brush_point_details.empty())
+					session.Cancel();
+				else
+					evaluate = true;
+			}
+			grabcut_progress = session.HasNewResult();
+		}
+
 		// Passing CV parameters
 		if(evaluate) {
 			CreateImageProcParam(current_draw_shape, draw_rect, ImPar, poly, zoom.current, marker, brush_point_details,
@@ -1133,49 +1448,44 @@ int main(int, char**) {
 		// Execute computer vision algorithm(s) and copy the resulting image to the texture
 		if((LabelState::Instance().drawingFinished && evaluate)
 		   || drawClassRegion
-		   || reset_gui) {
+		   || reset_gui
+		   || grabcut_progress) {
 
 #pragma region M1 : MAP_FROM_DEVICE_CONTEXT
-			/* Documentation:
-			You can use the CreateTexture2D Method of your device to create a
-			texture, and then the UpdateSubresource Method of a device-context to
-			update the texture data. There is also a Map method for the device -
-			context that can be used to give you a pointer to the texture -
-			memory. If you want to use that method to update your texture, you
-			need to create it with the appropriate CPU access flags and dynamic
-			usage.See the D3D11_TEXTURE2D_DESC Structure for information on all
-			the flags.UpdateSubresource will probably be more efficient.  */
-
-			// Method 1: mapping from an to the device context
-			D3D11_MAPPED_SUBRESOURCE mappedTex;  // Provides access to subresource data.
-			auto D3D_feature_info = g_pd3dDevice->GetFeatureLevel();
-			// is D3D_FEATURE_LEVEL_11_0 --> the pointerD3D11_MAPPED_SUBRESOURCE{void *pData) is aligned to 16 bytes.)
-
-			// get the texture pointer for the shader view
-			ID3D11Texture2D* pTextureInterface = 0;
-			ID3D11Resource* res;
-			tex_shader_res_view->GetResource(&res);
-			res->QueryInterface<ID3D11Texture2D>(&pTextureInterface);
-			D3D11_TEXTURE2D_DESC desc;
-			pTextureInterface->GetDesc(&desc);  // desc seems to be correct
-
-			// I) First try to get and map the texture pointer, then change the texture and memcopy; 
-			// whatever second parameter (UNIT subresource)	may be, set_with_check 0
-			auto HRes = g_pd3dDeviceContext->Map(
-				pTextureInterface, 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedTex);
+			/* The result is rendered directly into the frame of the display surface (each output pixel written once),
+			only the tiles of the changed regions are marked. The tiles are uploaded (each its own dynamic texture, 
+			mapped with WRITE_DISCARD) when drawn. */
+			static cv::Rect last_changed; // differs from the plain image in the frame
 
 			// Do the computer vision
-			cv::UMat updatedTexCV;
+			auto render = [&](CvOperation OP) {
+				DisplaySurface& surface = DisplaySurface::Main();
+				cv::Mat& frame = surface.Frame(LabelState::Instance().GetCurrentImg().size());
+				cv::Rect changed;
+				if(ApplyCVOperation(ImPar, (float*)&picked_color, OP, frame, changed)) {
+					surface.MarkDirty(last_changed | changed);
+					last_changed = changed;
+				} else { 
+					// no image: the hint text (another size) - the tiles are compared
+					surface.SetFrame(ApplyCVOperation(ImPar, (float*)&picked_color, OP).getMat(cv::ACCESS_READ));
+					last_changed = cv::Rect(cv::Point(0, 0), surface.Size());
+				}
+			};
+			show_overlay = drawClassRegion && ImPar.drawAllClasses; // the other operations show their own result
 			if(drawClassRegion) {
 				if(ImPar.drawAllClasses) {
-					updatedTexCV = ApplyCVOperation(ImPar, (float*)&picked_color, DisplayAllClasses);
+					render(DisplayAllClasses);
 					ImPar.drawAllClasses = false; // reset 
 				} else {
-					updatedTexCV = ApplyCVOperation(ImPar, (float*)&picked_color, DisplayClass);
+					render(DisplayClass);
 				}
 			} else if(current_draw_shape == CutsD) {
 				CvOperation OP = GrabCut; // only one of the two
-				updatedTexCV = ApplyCVOperation(ImPar, (float*)&picked_color, GrabCut);
+				ImPar.grabCutRestart = LabelState::Instance().drawingFinished && evaluate;
+				render(GrabCut);
+				if(ImPar.grabCutRestart)
+					grabcut_scribbles = brush_point_details.size(); // conflicting points are removed by now
+				ImPar.grabCutRestart = false;
 				use_grabcut = false;
 			} else if(use_floodfill) {
 				CvOperation OP = Floodfill;
@@ -1183,88 +1493,28 @@ int main(int, char**) {
 				if(fill_inner_pixels) {
 					OP = (CvOperation)(FillMask | OP);
 				}
-				updatedTexCV =
-					ApplyCVOperation(ImPar, (float*)&picked_color, OP);
+				render(OP);
 				use_floodfill = false;
 			} else if(reset_gui) {
 				CvOperation OP = Clear;
-				updatedTexCV =
-					ApplyCVOperation(ImPar, (float*)&picked_color, OP);
+				render(OP);
 				reset_gui = false;
 			} else if (replace_class) {
 				// add class mask to replace in the current ROI to the new (temporary class mask) 
 				// next frame it is added automatically to the new state
-                updatedTexCV = ApplyCVOperation(ImPar, (float*)&picked_color, ReplaceClass); 
+                render(ReplaceClass); 
 			} else {  // default apply CV			
 				CvOperation OP = Threshold;
 				if(fill_inner_pixels) {
 					OP = (CvOperation)(FillMask | OP);
 				}
-				updatedTexCV = ApplyCVOperation(ImPar, (float*)&picked_color, OP);
+				render(OP);
 				// clear brush after adding
 				if(ImPar.roi_shape == BrushD) {
 					brush_point_details.clear();
 				}
 			}
 
-			// II) Update the texture with the changes of the image
-			uint8_t* dst = (uint8_t*)mappedTex.pData;
-			auto pitchINfo = mappedTex.DepthPitch;
-			auto pitchINfoRow = mappedTex.RowPitch;
-
-			// pay attention to add the fourth channel !!
-			if(updatedTexCV.channels() != 4) {
-				cv::cvtColor(updatedTexCV, updatedTexCV, cv::COLOR_BGR2RGBA);
-			}
-			// else color channel order should be already correct here!
-
-			// uint8_t* src = (uint8_t*)updatedTexCV.data; // only cv::Mat
-
-			// If the UMat is not on the CPU, this will download it to a Mat
-			cv::Mat tempMat = updatedTexCV.getMat(cv::ACCESS_READ);
-			// Now the Mat can and its .data member can be accessed
-			uint8_t* src = (uint8_t*)tempMat.data;
-
-			// src and dst should be rgba data
-			int count = 0;
-			const uint32_t pixelSize = sizeof(desc.Format);
-			const uint32_t srcPitch = pixelSize * desc.Width;
-			for(int i = 0; i < desc.Height; i++) {
-				// copying should actually be done on the mapped Ressource
-				std::memcpy(dst, src, desc.Width * 4);
-
-				dst += mappedTex.RowPitch;
-				src += desc.Width * 4;
-				count++;
-			}
-
-			// uint8_t* pPixel = reinterpret_cast<uint8_t*>(mappedTex.pData); //-->
-			// actually does work 	for (int k = 0; k < desc.Height * srcPitch; k++)
-			// {
-			//		*pPixel = 250;
-			//		pPixel++;
-			//	}
-
-			//// var2:
-			// const uint32_t pixelSize = sizeof(desc.Format);
-			// const uint32_t srcPitch = pixelSize * desc.Width;
-			// uint8_t* textureData = reinterpret_cast<uint8_t*>(mappedTex.pData);
-			// const uint8_t* srcData = reinterpret_cast<const
-			// uint8_t*>(pTextureInterface.data()); for (uint32_t i = 0; i <
-			// textureHeight; ++i) {
-			//	// Copy the texture data for a single row
-			//	memcpy(textureData, srcData, srcPitch);
-
-			//	// Advance the pointers
-			//	textureData += data.RowPitch;
-			//	srcData += srcPitch;
-			//}
-
-			// III). call ID3D11DeviceContext::Unmap after finishing writing data to memory (ram)
-			g_pd3dDeviceContext->Unmap(pTextureInterface, 0);
-			pTextureInterface->Release();
-			pTextureInterface = NULL;
-
 #pragma endregion M1 : MAP_FROM_DEVICE_CONTEXT
 
 
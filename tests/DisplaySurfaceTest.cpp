@@ -0,0 +1,149 @@
+/*
+ * This file is part of PixLabelCV.
+ *
+ * Copyright (C) 2024 Dominik Schraml
+ *
+ * PixLabelCV is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Alternatively, commercial licenses are available. Please contact SQB Ilmenau
+ * at olaf.glaessner@sqb-ilmenau.de or dominik.schraml@sqb-ilmenau.de for more details.
+ *
+ * PixLabelCV is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PixLabelCV. If not, see <http://www.gnu.org/licenses/>.
+ */
+// Headless test of the display tiles (no Direct3D needed) - on Linux e.g.:
+//   g++ -std=c++17 -I../sources DisplaySurfaceTest.cpp ../sources/DisplaySurface.cpp ../sources/MemoryTracker.cpp \
+//       $(pkg-config --cflags --libs opencv4) -o DisplaySurfaceTest && ./DisplaySurfaceTest
+// Returns the number of failed checks.
+#include "DisplaySurface.h"
+#include <iostream>
+
+using namespace cv;
+
+static int failures = 0;
+
+#define CHECK(condition) \
+	do { if(!(condition)) { std::cout << __FILE__ << ":" << __LINE__ << " FAILED: " #condition "\n"; failures++; } } while(0)
+
+// refuses every upload - the tiles have to stay dirty
+class FailingUploader : public TileUploader
+{
+public:
+	bool Upload(int, const cv::Mat&) override { return false; }
+	void* Texture(int) override { return nullptr; }
+	void Release() override {}
+};
+
+static Mat testFrame(Size size) {
+	Mat frame(size, CV_8UC4);
+	randu(frame, 0, 256);
+	return frame;
+}
+
+static bool equal(const Mat& a, const Mat& b) {
+	return a.size() == b.size() && countNonZero(a.reshape(1) != b.reshape(1)) == 0;
+}
+
+// 2500 x 1100 pixels: 3 x 2 tiles, the last column and row are partial
+static void tileSplitting() {
+	DisplaySurface surface;
+	surface.SetFrame(testFrame(Size(2500, 1100)));
+	CHECK(surface.TileCount() == 6);
+	CHECK(surface.TileRect(0) == Rect(0, 0, 1024, 1024));
+	CHECK(surface.TileRect(2) == Rect(2048, 0, 452, 1024));
+	CHECK(surface.TileRect(3) == Rect(0, 1024, 1024, 76));
+	CHECK(surface.TileRect(5) == Rect(2048, 1024, 452, 76));
+	CHECK(surface.TilesIn(Rect(1000, 1000, 50, 50)) == std::vector<int>({ 0, 1, 3, 4 }));
+	CHECK(surface.TilesIn(Rect(2400, 1050, 500, 500)) == std::vector<int>({ 5 })); // clipped at the border
+	CHECK(surface.TilesIn(Rect(3000, 0, 10, 10)).empty());
+
+	// the partial tiles are uploaded with their own size
+	MemoryTileUploader uploader;
+	CHECK(surface.Upload(Rect(0, 0, 2500, 1100), uploader) == 6);
+	CHECK(uploader.Tile(5).size() == Size(452, 76));
+	CHECK(uploader.bytes == int64_t(2500) * 1100 * 4);
+}
+
+// only the tiles whose pixels changed are uploaded - and only when they are visible
+static void uploadOnlyDirty() {
+	Mat frame = testFrame(Size(2500, 1100));
+	DisplaySurface surface;
+	MemoryTileUploader uploader;
+	surface.SetFrame(frame);
+	surface.Upload(Rect(0, 0, 2500, 1100), uploader);
+	CHECK(surface.Upload(Rect(0, 0, 2500, 1100), uploader) == 0); // nothing changed since
+
+	surface.SetFrame(frame.clone()); // the same pixels
+	CHECK(surface.Upload(Rect(0, 0, 2500, 1100), uploader) == 0);
+
+	frame(Rect(1500, 1050, 10, 10)).setTo(Scalar(1, 2, 3, 255)); // inside tile 4
+	surface.SetFrame(frame);
+	const int before = uploader.uploads;
+	CHECK(surface.Upload(Rect(0, 0, 2500, 1100), uploader) == 1);
+	CHECK(uploader.uploads - before == 1);
+	CHECK(equal(uploader.Tile(4), frame(surface.TileRect(4))));
+
+	// invisible dirty tiles wait until they are scrolled into view
+	frame.setTo(Scalar(4, 5, 6, 255));
+	surface.SetFrame(frame);
+	CHECK(surface.Upload(Rect(0, 0, 100, 100), uploader) == 1);
+	CHECK(surface.Upload(Rect(0, 0, 2500, 1100), uploader) == 5);
+
+	// a failed upload is tried again
+	surface.MarkAllDirty();
+	FailingUploader failing;
+	CHECK(surface.Upload(Rect(0, 0, 2500, 1100), failing) == 0);
+	CHECK(surface.Upload(Rect(0, 0, 2500, 1100), uploader) == 6);
+}
+
+// marked rects: overlapping ones mark each tile once, pixels outside of the rects are not taken
+static void dirtyRects() {
+	Mat frame = testFrame(Size(2500, 1100));
+	DisplaySurface surface;
+	MemoryTileUploader uploader;
+	surface.SetFrame(frame);
+	surface.Upload(Rect(0, 0, 2500, 1100), uploader);
+
+	const int changedBefore = surface.counters.changedTiles;
+	surface.MarkDirty(Rect(1000, 10, 100, 100)); // tiles 0 and 1
+	surface.MarkDirty(Rect(1050, 50, 100, 100)); // tile 1 again
+	surface.MarkDirty(Rect(-50, -50, 10, 10));   // outside
+	CHECK(surface.counters.changedTiles - changedBefore == 2);
+	CHECK(surface.Upload(Rect(0, 0, 2500, 1100), uploader) == 2);
+
+	Mat next = frame.clone();
+	next(Rect(10, 10, 20, 20)).setTo(Scalar(7, 8, 9, 255));     // tile 0 - in the rect
+	next(Rect(2100, 1060, 20, 20)).setTo(Scalar(7, 8, 9, 255)); // tile 5 - not in the rect
+	surface.SetFrame(next, { Rect(0, 0, 100, 100) });
+	CHECK(surface.Upload(Rect(0, 0, 2500, 1100), uploader) == 1);
+	CHECK(equal(uploader.Tile(0), next(surface.TileRect(0))));
+	CHECK(equal(uploader.Tile(5), frame(surface.TileRect(5))));
+
+	// rendered directly into the kept frame
+	Mat& target = surface.Frame(Size(2500, 1100));
+	target(Rect(2048, 0, 10, 10)).setTo(Scalar(1, 1, 1, 255));
+	surface.MarkDirty(Rect(2048, 0, 10, 10));
+	CHECK(surface.Upload(Rect(0, 0, 2500, 1100), uploader) == 1);
+	CHECK(equal(uploader.Tile(2), target(surface.TileRect(2))));
+
+	// another size starts over
+	surface.Frame(Size(1000, 500));
+	CHECK(surface.TileCount() == 1);
+	CHECK(surface.Upload(Rect(0, 0, 1000, 500), uploader) == 1);
+}
+
+int main() {
+	tileSplitting();
+	uploadOnlyDirty();
+	dirtyRects();
+	std::cout << (failures == 0 ? "all display surface checks passed\n" : "display surface checks failed\n");
+	return failures;
+}